@@ -0,0 +1,249 @@
+// A microbenchmark for cpp2c's preprocessor callbacks.
+//
+// Runs a clang::Preprocessor over generated inputs with and without
+// MacroForest and DefinitionInfoCollector attached, and reports the time and
+// number of operator new calls per macro expansion that each of them adds.
+
+#include "DefinitionInfoCollector.hh"
+#include "MacroForest.hh"
+
+#include "clang/Basic/Diagnostic.h"
+#include "clang/Basic/TargetInfo.h"
+#include "clang/Basic/TargetOptions.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Lex/PPCallbacks.h"
+#include "clang/Lex/Preprocessor.h"
+
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <limits>
+#include <memory>
+#include <new>
+#include <string>
+
+// Count every allocation made through operator new, including those made by
+// Clang, so that the allocations a callback adds can be measured
+static std::atomic<unsigned long> NumAllocations(0);
+
+void *operator new(size_t Size) {
+        NumAllocations.fetch_add(1, std::memory_order_relaxed);
+        if (void *P = std::malloc(Size ? Size : 1))
+                return P;
+        llvm::report_bad_alloc_error("operator new failed");
+}
+
+void operator delete(void *P) noexcept {
+        std::free(P);
+}
+
+void operator delete(void *P, size_t) noexcept {
+        std::free(P);
+}
+
+namespace cpp2c {
+static llvm::cl::opt<unsigned>
+        Count("count", llvm::cl::desc("Number of top-level expansions"),
+              llvm::cl::init(10000));
+
+static llvm::cl::opt<unsigned>
+        Depth("depth",
+              llvm::cl::desc("Length of the chain of object-like macros"),
+              llvm::cl::init(16));
+
+static llvm::cl::opt<unsigned>
+        Width("width",
+              llvm::cl::desc("Number of arguments of function-like macros"),
+              llvm::cl::init(16));
+
+static llvm::cl::opt<unsigned>
+        Repetitions("repetitions",
+                    llvm::cl::desc("Number of times to run each "
+                                   "configuration; the fastest run is "
+                                   "reported"),
+                    llvm::cl::init(5));
+
+// Counts macro expansions.
+// Attached in every configuration so that its cost cancels out.
+class ExpansionCounter : public clang::PPCallbacks {
+    public:
+        unsigned long &N;
+
+        ExpansionCounter(unsigned long &N)
+                : N(N) {
+        }
+
+        void MacroExpands(const clang::Token &MacroNameTok,
+                          const clang::MacroDefinition &MD,
+                          clang::SourceRange Range,
+                          const clang::MacroArgs *Args) override {
+                N++;
+        }
+};
+
+// Object-like macros that each expand to the next: L<Depth> -> ... -> L0
+static std::string generateChain() {
+        std::string S = "#define L0 0\n";
+        for (unsigned I = 1; I <= Depth; I++)
+                S += "#define L" + std::to_string(I) + " L" +
+                     std::to_string(I - 1) + "\n";
+        for (unsigned I = 0; I < Count; I++)
+                S += "int c" + std::to_string(I) + " = L" +
+                     std::to_string(Depth) + ";\n";
+        return S;
+}
+
+// Function-like macros with Width parameters, each used once in the body
+static std::string generateWide() {
+        std::string Params, Body, Args;
+        for (unsigned I = 0; I < Width; I++) {
+                auto N = std::to_string(I);
+                Params += (I ? ", a" : "a") + N;
+                Body += (I ? " + (a" : "(a") + N + ")";
+                Args += (I ? ", " : "") + N;
+        }
+        if (Width == 0)
+                Body = "0";
+        std::string S = "#define W(" + Params + ") (" + Body + ")\n";
+        for (unsigned I = 0; I < Count; I++)
+                S += "int w" + std::to_string(I) + " = W(" + Args + ");\n";
+        return S;
+}
+
+// Variadic macros passed Width variable arguments
+static std::string generateVariadic() {
+        std::string Args;
+        for (unsigned I = 0; I < Width; I++)
+                Args += ", " + std::to_string(I);
+        std::string S = "int f(int, ...);\n"
+                        "#define V(x, ...) f(x, ##__VA_ARGS__)\n";
+        for (unsigned I = 0; I < Count; I++)
+                S += "int v" + std::to_string(I) + " = V(0" + Args + ");\n";
+        return S;
+}
+
+enum Config { None, Forest, Collector, Both };
+
+static const char *configName(Config C) {
+        switch (C) {
+        case None:
+                return "none";
+        case Forest:
+                return "MacroForest";
+        case Collector:
+                return "DefinitionInfoCollector";
+        case Both:
+                return "both";
+        }
+        return "";
+}
+
+struct Measurement {
+        double Nanoseconds = std::numeric_limits<double>::max();
+        unsigned long Allocations = 0;
+        unsigned long Expansions = 0;
+};
+
+// Preprocesses the given source with the callbacks of the given configuration
+// attached, and returns the time and allocations spent lexing it
+static Measurement preprocess(const std::string &Source, Config C) {
+        clang::CompilerInstance CI;
+        CI.createDiagnostics(new clang::IgnoringDiagConsumer());
+        auto TO = std::make_shared<clang::TargetOptions>();
+        TO->Triple = llvm::sys::getDefaultTargetTriple();
+        CI.setTarget(
+                clang::TargetInfo::CreateTargetInfo(CI.getDiagnostics(), TO));
+        CI.createFileManager();
+        CI.createSourceManager(CI.getFileManager());
+        CI.createPreprocessor(clang::TU_Complete);
+        CI.createASTContext();
+
+        auto &PP = CI.getPreprocessor();
+        auto &SM = CI.getSourceManager();
+        SM.setMainFileID(SM.createFileID(
+                llvm::MemoryBuffer::getMemBuffer(Source, "bench.c")));
+
+        Measurement M;
+        PP.addPPCallbacks(std::make_unique<ExpansionCounter>(M.Expansions));
+        cpp2c::MacroForest *MF = nullptr;
+        if (C == Forest || C == Both) {
+                MF = new cpp2c::MacroForest(PP, CI.getASTContext());
+                PP.addPPCallbacks(std::unique_ptr<cpp2c::MacroForest>(MF));
+        }
+        if (C == Collector || C == Both)
+                PP.addPPCallbacks(
+                        std::make_unique<cpp2c::DefinitionInfoCollector>(
+                                CI.getASTContext()));
+
+        auto Allocations = NumAllocations.load();
+        auto T0 = std::chrono::steady_clock::now();
+        PP.EnterMainSourceFile();
+        clang::Token Tok;
+        do
+                PP.Lex(Tok);
+        while (Tok.isNot(clang::tok::eof));
+        auto T1 = std::chrono::steady_clock::now();
+        M.Allocations = NumAllocations.load() - Allocations;
+        M.Nanoseconds = std::chrono::duration<double, std::nano>(T1 - T0)
+                                .count();
+
+        PP.EndSourceFile();
+        if (MF)
+                for (auto &&Exp : MF->Expansions)
+                        if (Exp->Depth == 0)
+                                delete Exp;
+        return M;
+}
+
+static void runWorkload(const char *Name, const std::string &Source) {
+        Measurement Results[Both + 1];
+        for (int C = None; C <= Both; C++)
+                for (unsigned R = 0; R < Repetitions; R++) {
+                        auto M = preprocess(Source, Config(C));
+                        if (M.Nanoseconds < Results[C].Nanoseconds)
+                                Results[C] = M;
+                }
+
+        auto &Base = Results[None];
+        llvm::outs() << Name << ": " << Base.Expansions << " expansions\n";
+        llvm::outs() << "  callbacks                  ns/expansion   "
+                        "allocs/expansion\n";
+        for (int C = None; C <= Both; C++) {
+                auto &M = Results[C];
+                double N = std::max(M.Expansions, 1UL);
+                // Report the cost that the callbacks add to preprocessing
+                double Ns = C == None ? M.Nanoseconds :
+                                        M.Nanoseconds - Base.Nanoseconds;
+                double Allocs = C == None ? double(M.Allocations) :
+                                            double(M.Allocations) -
+                                                    double(Base.Allocations);
+                llvm::outs() << llvm::format("  %-24s %14.1f %18.2f\n",
+                                             configName(Config(C)), Ns / N,
+                                             Allocs / N);
+        }
+}
+} // namespace cpp2c
+
+int main(int argc, char const *argv[]) {
+        using namespace cpp2c;
+
+        llvm::cl::ParseCommandLineOptions(
+                argc, argv, "cpp2c preprocessor callback microbenchmark\n");
+        if (Repetitions == 0)
+                Repetitions = 1;
+
+        llvm::outs() << "The 'none' row is the cost of preprocessing alone; "
+                        "other rows are the cost the callbacks add to it\n";
+        runWorkload("object-like chain", generateChain());
+        runWorkload("wide function-like", generateWide());
+        runWorkload("variadic", generateVariadic());
+        return 0;
+}
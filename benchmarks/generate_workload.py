@@ -0,0 +1,133 @@
+#!/usr/bin/python3
+
+import argparse
+import random
+import sys
+from dataclasses import dataclass
+from typing import List, TextIO
+
+
+@dataclass
+class WorkloadParams:
+    '''Parameters of a synthetic macro workload'''
+    # the total number of top-level macro expansions
+    num_expansions: int = 1000
+    # the number of macros each function-like expansion expands through
+    nesting_depth: int = 1
+    # the number of arguments of each function-like macro
+    num_args: int = 2
+    # the number of operands in each macro argument
+    arg_size: int = 1
+    # the fraction of expansions that stringify an argument
+    stringification_ratio: float = 0.1
+    # the fraction of expansions that paste tokens together
+    pasting_ratio: float = 0.1
+    # the number of extra statements surrounding each expansion
+    stmts_per_expansion: int = 2
+    # the number of expansions in each generated function
+    expansions_per_function: int = 20
+    # the seed to generate the workload with
+    seed: int = 0
+
+
+def macro_name(level: int) -> str:
+    return f'M{level}'
+
+
+def generate_definitions(p: WorkloadParams, out: TextIO) -> None:
+    '''
+    Prints the macro definitions of the workload.
+    M0 is the innermost macro; each macro Mi expands to Mi-1 so that
+    expanding M<depth-1> expands through depth macros.
+    '''
+    params = [f'a{k}' for k in range(p.num_args)]
+    print('#define OBJ 42', file=out)
+    print(f'#define {macro_name(0)}({", ".join(params)}) '
+          f'({" + ".join(f"({a})" for a in params) if params else "OBJ"})',
+          file=out)
+    for level in range(1, p.nesting_depth):
+        print(f'#define {macro_name(level)}({", ".join(params)}) '
+              f'{macro_name(level - 1)}({", ".join(params)})', file=out)
+    print('#define STR(x) #x', file=out)
+    print('#define CAT(a, b) a##b', file=out)
+    print('', file=out)
+
+
+def generate_argument(p: WorkloadParams, rng: random.Random,
+                      locals_: List[str]) -> str:
+    operands = [rng.choice(locals_ + ['OBJ', '1'])
+                for _ in range(max(p.arg_size, 1))]
+    return ' + '.join(operands)
+
+
+def generate_expansion(p: WorkloadParams, rng: random.Random,
+                       locals_: List[str], index: int) -> str:
+    '''Returns a statement that contains exactly one top-level expansion'''
+    r = rng.random()
+    if r < p.stringification_ratio:
+        return (f'const char *s{index} = '
+                f'STR({generate_argument(p, rng, locals_)});')
+    if r < p.stringification_ratio + p.pasting_ratio:
+        return f'int CAT(v, {index}) = {locals_[0]};'
+    args = [generate_argument(p, rng, locals_) for _ in range(p.num_args)]
+    return (f'{locals_[0]} += '
+            f'{macro_name(p.nesting_depth - 1)}({", ".join(args)});')
+
+
+def generate_workload(p: WorkloadParams, out: TextIO) -> None:
+    '''Prints a C translation unit with the given parameters'''
+    rng = random.Random(p.seed)
+    generate_definitions(p, out)
+
+    num_functions = ((p.num_expansions + p.expansions_per_function - 1) //
+                     p.expansions_per_function)
+    index = 0
+    for f in range(num_functions):
+        print(f'int f{f}(int x, int y)', file=out)
+        print('{', file=out)
+        # the first local is the accumulator each expansion updates
+        locals_ = ['acc', 'x', 'y']
+        print('    int acc = 0;', file=out)
+        for _ in range(p.expansions_per_function):
+            if index == p.num_expansions:
+                break
+            for k in range(p.stmts_per_expansion):
+                print(f'    if ({rng.choice(locals_)} > {k}) '
+                      f'{locals_[0]} ^= {rng.choice(locals_)} * {k + 1};',
+                      file=out)
+            print(f'    {generate_expansion(p, rng, locals_, index)}',
+                  file=out)
+            index += 1
+        print(f'    return {locals_[0]};', file=out)
+        print('}', file=out)
+        print('', file=out)
+
+
+def add_arguments(ap: argparse.ArgumentParser) -> None:
+    '''Adds an option for each workload parameter to the given parser'''
+    defaults = WorkloadParams()
+    for name, value in vars(defaults).items():
+        ap.add_argument(f'--{name}', type=type(value), default=value)
+
+
+def main():
+    ap = argparse.ArgumentParser(
+        description='Generate a synthetic C translation unit for '
+        'benchmarking cpp2c')
+    add_arguments(ap)
+    ap.add_argument('-o', '--output', type=str, default=None,
+                    help='file to write to instead of stdout')
+    args = ap.parse_args()
+
+    params = WorkloadParams(**{
+        k: v for k, v in vars(args).items() if k != 'output'
+    })
+    if args.output is None:
+        generate_workload(params, sys.stdout)
+    else:
+        with open(args.output, 'w') as fp:
+            generate_workload(params, fp)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,160 @@
+#!/usr/bin/python3
+
+import argparse
+import csv
+import json
+import math
+import os
+import subprocess
+import sys
+from dataclasses import asdict, replace
+from typing import Dict, List, Tuple
+
+from generate_workload import WorkloadParams, generate_workload
+
+PHASES = ['Parse', 'Collect', 'Align', 'Properties', 'Emit']
+
+# Each suite varies some workload parameters and keeps the others at their
+# default values
+BASE = WorkloadParams()
+SUITES: Dict[str, List[WorkloadParams]] = {
+    'scaling': [replace(BASE, num_expansions=n)
+                for n in [250, 500, 1000, 2000, 4000, 8000]],
+    'nesting': [replace(BASE, nesting_depth=d)
+                for d in [1, 2, 4, 8, 16]],
+    'arguments': [replace(BASE, num_args=a, arg_size=s)
+                  for a in [0, 1, 4, 8] for s in [1, 8]],
+    'stringification': [replace(BASE, stringification_ratio=r,
+                                pasting_ratio=r)
+                        for r in [0.0, 0.25, 0.5]],
+    'ast_size': [replace(BASE, stmts_per_expansion=n)
+                 for n in [0, 4, 16, 64]],
+}
+
+
+def run_cpp2c(clang: str, cpp2c_so_path: str, src_path: str) -> dict:
+    '''
+    Runs cpp2c on the given source file and returns the statistics it
+    reports for each phase of its analysis
+    '''
+    base = os.path.splitext(src_path)[0]
+    stats_path = base + '.stats.json'
+    cmd = [
+        clang,
+        f'-fplugin={cpp2c_so_path}',
+        f'-fplugin-arg-macro-types-output={base}.cpp2c.json',
+        f'-fplugin-arg-macro-types-stats={stats_path}',
+        '-fsyntax-only',
+        '-w',
+        src_path,
+    ]
+    subprocess.run(cmd, check=True)
+    with open(stats_path) as fp:
+        return json.load(fp)
+
+
+def run_suite(name: str, clang: str, cpp2c_so_path: str, work_dir: str,
+              repetitions: int) -> List[dict]:
+    '''
+    Runs the given suite and returns a row for each of its workloads, with the
+    workload's parameters, the fastest time and the least growth of resident
+    memory measured for each phase, and the least peak memory usage measured
+    '''
+    rows = []
+    for j, params in enumerate(SUITES[name]):
+        src_path = os.path.join(work_dir, f'{name}_{j}.c')
+        with open(src_path, 'w') as fp:
+            generate_workload(params, fp)
+
+        row = {'suite': name, **asdict(params)}
+        runs = [run_cpp2c(clang, cpp2c_so_path, src_path)
+                for _ in range(repetitions)]
+        row['analyzed_expansions'] = runs[0]['NumExpansions']
+        for phase in PHASES:
+            stats = [next(p for p in r['Phases'] if p['Name'] == phase)
+                     for r in runs]
+            row[f'{phase}_seconds'] = min(s['Seconds'] for s in stats)
+            row[f'{phase}_rss_growth_kib'] = min(s['RSSGrowthKiB']
+                                                 for s in stats)
+        row['analysis_seconds'] = sum(row[f'{phase}_seconds']
+                                      for phase in PHASES
+                                      if phase != 'Parse')
+        row['peak_rss_kib'] = min(r['PeakRSSKiB'] for r in runs)
+        rows.append(row)
+        print(f'{name} {j}: {row["analyzed_expansions"]} expansions, '
+              f'{row["analysis_seconds"]:.3f}s analysis, '
+              f'{row["peak_rss_kib"]} KiB peak', file=sys.stderr)
+    return rows
+
+
+def scaling_exponent(points: List[Tuple[float, float]]) -> float:
+    '''
+    Returns the slope of the least-squares line through the given points on a
+    log-log scale, i.e., k such that y grows like x^k
+    '''
+    logs = [(math.log(x), math.log(y)) for x, y in points if x > 0 and y > 0]
+    if len(logs) < 2:
+        return float('nan')
+    mx = sum(x for x, _ in logs) / len(logs)
+    my = sum(y for _, y in logs) / len(logs)
+    num = sum((x - mx) * (y - my) for x, y in logs)
+    den = sum((x - mx) ** 2 for x, _ in logs)
+    return num / den if den else float('nan')
+
+
+def main():
+    ap = argparse.ArgumentParser(
+        description='Run cpp2c on synthetic workloads and report the time '
+        'and memory growth of each phase of its analysis')
+    ap.add_argument('cpp2c_so_path', type=str)
+    ap.add_argument('work_dir', type=str,
+                    help='directory to write generated workloads to')
+    ap.add_argument('--clang', type=str, default='clang-14')
+    ap.add_argument('--suite', type=str, action='append',
+                    choices=sorted(SUITES.keys()),
+                    help='suite to run; may be given more than once '
+                    '(default: all suites)')
+    ap.add_argument('--repetitions', type=int, default=3,
+                    help='number of times to run each workload; the '
+                    'fastest run is reported')
+    ap.add_argument('--csv', type=str, default=None,
+                    help='file to write all measurements to')
+    args = ap.parse_args()
+
+    cpp2c_so_path = os.path.abspath(args.cpp2c_so_path)
+    os.makedirs(args.work_dir, exist_ok=True)
+
+    rows = []
+    for name in args.suite or SUITES.keys():
+        rows.extend(run_suite(name, args.clang, cpp2c_so_path, args.work_dir,
+                              args.repetitions))
+
+    if args.csv is not None:
+        with open(args.csv, 'w', newline='') as fp:
+            w = csv.DictWriter(fp, fieldnames=list(rows[0].keys()))
+            w.writeheader()
+            w.writerows(rows)
+
+    # report how the analysis time grows with the size of the translation
+    # unit; an exponent near 1 is linear, and near 2 is quadratic
+    scaling = [r for r in rows if r['suite'] == 'scaling']
+    if scaling:
+        for phase in PHASES:
+            k = scaling_exponent([(r['analyzed_expansions'],
+                                   r[f'{phase}_seconds'])
+                                  for r in scaling])
+            print(f'{phase} time grows like expansions^{k:.2f}')
+        k = scaling_exponent([(r['analyzed_expansions'],
+                               r['analysis_seconds'])
+                              for r in scaling])
+        print(f'Analysis time grows like expansions^{k:.2f}')
+        # phases that free more than they allocate are left out of the fit
+        for phase in PHASES:
+            k = scaling_exponent([(r['analyzed_expansions'],
+                                   r[f'{phase}_rss_growth_kib'])
+                                  for r in scaling])
+            print(f'{phase} memory growth grows like expansions^{k:.2f}')
+
+
+if __name__ == '__main__':
+    main()
@@ -1,14 +1,22 @@
 #!/usr/bin/python3
 
 import argparse
+import contextlib
+import hashlib
 import json
 import os
+import re
+import shlex
+import shutil
 import subprocess
 import sys
+import tempfile
+import threading
+import time
 from dataclasses import dataclass
 from itertools import repeat
 from multiprocessing.pool import ThreadPool
-from typing import List
+from typing import Dict, List, Optional, Tuple
 
 
 @dataclass
@@ -20,6 +28,14 @@ class CompileCommand:
 
 DELIM = "\t"
 
+# Estimated cost of each file a source file includes, in bytes of source code.
+# Only used to schedule files that have not been analyzed before.
+INCLUDE_COST = 16 * 1024
+
+# The name of the file in the destination directory that records how long it
+# took to analyze each source file
+DURATIONS_FILE = 'durations.json'
+
 
 def removeprefix(s: str, t: str):
     '''Custom removeprefix function for Python 3.8.10 support'''
@@ -29,20 +45,262 @@ def removeprefix(s: str, t: str):
     return s[i+len(t):]
 
 
+def file_digest(path: str) -> str:
+    '''Returns the SHA-256 digest of the contents of the given file'''
+    h = hashlib.sha256()
+    with open(path, 'rb') as fp:
+        for chunk in iter(lambda: fp.read(1 << 20), b''):
+            h.update(chunk)
+    return h.hexdigest()
+
+
+def atomic_copy(src: str, dst: str) -> None:
+    '''
+    Copies src to dst so that dst either does not exist or is a complete
+    copy of src, even if this process is interrupted
+    '''
+    fd, tmp = tempfile.mkstemp(dir=os.path.dirname(dst), suffix='.tmp')
+    os.close(fd)
+    try:
+        shutil.copyfile(src, tmp)
+        os.replace(tmp, dst)
+    except BaseException:
+        os.remove(tmp)
+        raise
+
+
+class ResultCache:
+    '''
+    A content-addressed cache of cpp2c results.
+
+    Looking up a result takes two steps. First, the cpp2c plugin, the compile
+    command, and the main file's contents determine a manifest key. The
+    manifest lists the files that the main file included the last time it
+    was analyzed, as reported by cpp2c's deps plugin argument. Second, the
+    manifest key and the contents of these files determine the result key.
+    If any of these files changed, the lookup misses and the file is
+    analyzed again.
+    '''
+
+    def __init__(self, cache_dir: str, cpp2c_so_path: str):
+        self.manifests_dir = os.path.join(cache_dir, 'manifests')
+        self.results_dir = os.path.join(cache_dir, 'results')
+        os.makedirs(self.manifests_dir, exist_ok=True)
+        os.makedirs(self.results_dir, exist_ok=True)
+        # results depend on the version of cpp2c that computed them
+        self.cpp2c_digest = file_digest(cpp2c_so_path)
+
+    def manifest_key(self, args: List[str], directory: str,
+                     fullpath: str) -> str:
+        h = hashlib.sha256()
+        for s in [self.cpp2c_digest, directory, fullpath,
+                  file_digest(fullpath), *args]:
+            h.update(s.encode())
+            h.update(b'\0')
+        return h.hexdigest()
+
+    def result_key(self, manifest_key: str,
+                   deps: List[str]) -> Optional[str]:
+        h = hashlib.sha256(manifest_key.encode())
+        for d in deps:
+            try:
+                digest = file_digest(d)
+            except OSError:
+                return None
+            h.update(d.encode())
+            h.update(b'\0')
+            h.update(digest.encode())
+        return h.hexdigest()
+
+    def lookup(self, manifest_key: str, dst_path: str) -> bool:
+        '''
+        Copies the cached result for the given manifest key to dst_path.
+        Returns False if there is no up-to-date cached result.
+        '''
+        try:
+            with open(os.path.join(self.manifests_dir, manifest_key)) as fp:
+                deps = fp.read().splitlines()
+        except OSError:
+            return False
+        result_key = self.result_key(manifest_key, deps)
+        if result_key is None:
+            return False
+        result_path = os.path.join(self.results_dir, result_key + '.cpp2c')
+        if not os.path.isfile(result_path):
+            return False
+        atomic_copy(result_path, dst_path)
+        return True
+
+    def store(self, manifest_key: str, deps_path: str, dst_path: str) -> None:
+        '''
+        Caches the result in dst_path for the given manifest key, using the
+        dependencies that cpp2c wrote to deps_path
+        '''
+        with open(deps_path) as fp:
+            deps = fp.read().splitlines()
+        result_key = self.result_key(manifest_key, deps)
+        if result_key is None:
+            return
+        atomic_copy(dst_path,
+                    os.path.join(self.results_dir, result_key + '.cpp2c'))
+        atomic_copy(deps_path, os.path.join(self.manifests_dir, manifest_key))
+
+
+class ForkServer:
+    '''
+    A client for cpp2c-server, which runs compile commands in children forked
+    from a single process that has already loaded Clang and the cpp2c plugin,
+    instead of starting a new Clang process for each compile command
+    '''
+
+    def __init__(self, server_path: str, cpp2c_so_path: str,
+                 num_processes: int):
+        self.p = subprocess.Popen(
+            [server_path, f'-j={num_processes}', f'-load={cpp2c_so_path}'],
+            stdin=subprocess.PIPE, stdout=subprocess.PIPE, text=True)
+        self.lock = threading.Lock()
+        self.next_index = 0
+        # maps the index of each running compile command to an event to
+        # signal once it finishes, and a list to store its status in
+        self.pending: Dict[int, Tuple[threading.Event, List[int]]] = {}
+        self.reader = threading.Thread(target=self._read_statuses,
+                                       daemon=True)
+        self.reader.start()
+
+    def run(self, directory: str, args: List[str]) -> int:
+        '''
+        Runs the given compile command in the given directory and returns its
+        exit status, or the negated number of the signal that killed it
+        '''
+        done = threading.Event()
+        status: List[int] = []
+        with self.lock:
+            index = self.next_index
+            self.next_index += 1
+            self.pending[index] = (done, status)
+            print(json.dumps({'directory': directory, 'arguments': args}),
+                  file=self.p.stdin, flush=True)
+        done.wait()
+        return status[0]
+
+    def close(self) -> None:
+        self.p.stdin.close()
+        self.p.wait()
+        self.reader.join()
+
+    def _read_statuses(self) -> None:
+        for line in self.p.stdout:
+            result = json.loads(line)
+            with self.lock:
+                done, status = self.pending.pop(result['index'])
+            status.append(result['status'])
+            done.set()
+        # the server exited, so nothing that is still running will finish
+        with self.lock:
+            for done, status in self.pending.values():
+                status.append(1)
+                done.set()
+            self.pending.clear()
+
+
+def estimate_cost(fullpath: str) -> int:
+    '''
+    Estimates the cost of analyzing the given source file from its size and
+    the number of files it includes
+    '''
+    with open(fullpath, 'rb') as fp:
+        data = fp.read()
+    num_includes = len(re.findall(rb'^[ \t]*#[ \t]*include', data,
+                                  re.MULTILINE))
+    return len(data) + INCLUDE_COST * num_includes
+
+
+def descendants_rss() -> int:
+    '''
+    Returns the total resident memory, in bytes, of all descendants of this
+    process. Only supported on Linux; returns 0 elsewhere.
+    '''
+    children: Dict[int, List[int]] = {}
+    try:
+        pids = [int(d) for d in os.listdir('/proc') if d.isdigit()]
+    except OSError:
+        return 0
+    for pid in pids:
+        try:
+            with open(f'/proc/{pid}/stat') as fp:
+                # the command name may contain spaces, so split after it
+                ppid = int(fp.read().rsplit(')', 1)[1].split()[1])
+        except (OSError, IndexError, ValueError):
+            continue
+        children.setdefault(ppid, []).append(pid)
+
+    rss = 0
+    stack = list(children.get(os.getpid(), []))
+    while stack:
+        pid = stack.pop()
+        stack.extend(children.get(pid, []))
+        try:
+            with open(f'/proc/{pid}/statm') as fp:
+                rss += int(fp.read().split()[1]) * os.sysconf('SC_PAGE_SIZE')
+        except (OSError, IndexError, ValueError):
+            continue
+    return rss
+
+
+class MemoryBudget:
+    '''
+    Keeps new cpp2c runs from starting while the processes this script started
+    use more than the given amount of resident memory. A run always starts if
+    no other run is in progress, so that every file is eventually analyzed.
+    '''
+
+    def __init__(self, max_rss: int):
+        self.max_rss = max_rss
+        self.running = 0
+        self.cv = threading.Condition()
+
+    def __enter__(self):
+        with self.cv:
+            while self.running > 0 and descendants_rss() >= self.max_rss:
+                # memory is freed when a run finishes, but poll anyway in
+                # case a running analysis shrinks
+                self.cv.wait(timeout=1.0)
+            self.running += 1
+
+    def __exit__(self, *exc):
+        with self.cv:
+            self.running -= 1
+            self.cv.notify_all()
+
+
 def cpp2c(cpp2c_so_path: str,
           cc: CompileCommand,
           src_dir: str,
           dst_path: str,
+          cache: Optional[ResultCache],
+          server: Optional[ForkServer],
+          budget: Optional[MemoryBudget],
+          durations: Dict[str, float],
           i: List[int], n: int) -> None:
     '''
     Runs Cpp2C on the program that the given compile_commands.json file
-    comprises in the given src_dir, and prints the results to the outdir
+    comprises in the given src_dir, and prints the results to the outdir.
+    Skips the file if its results already exist; cpp2c only creates the
+    destination file once it has written all its results.
+    If a result cache is given, the file is never skipped, but its results
+    are copied from the cache if none of the files it includes changed.
 
     Parameters:
         cpp2c_so_path:  the path to the built cpp2c shared object file
         cc:             a compile command
         src_dir:        the src directory of the analyzed program
         dst_path:       the path of the file to write cpp2c's results to
+        cache:          the cache to look up and store results in, if any
+        server:         the fork server to run cpp2c with, if any
+        budget:         the memory budget to wait for before running cpp2c,
+                        if any
+        durations:      a dictionary to record the time it took to analyze
+                        the file in
         i:              a list containing a single integer, the current number of
                         files processed so far
         n:              the total number of files to process
@@ -89,8 +347,7 @@ def cpp2c(cpp2c_so_path: str,
     }
 
     args: list[str] = [
-        # ensure that escaped double quotes and parentheses are passed correctly
-        arg.replace('"', r'\"').replace("(", r"\(").replace(")", r"\)")
+        arg
         for arg in cc.arguments
         if not any([arg.startswith(ua) for ua in clang_unknown_args])
     ]
@@ -108,8 +365,19 @@ def cpp2c(cpp2c_so_path: str,
 
     # use clang-14
     args[0] = 'clang-14'
+    fullpath = os.path.realpath(os.path.join(cc.directory, cc.file))
+    # the cache key must not depend on where the results are written to,
+    # so compute it before adding the plugin arguments
+    manifest_key = (cache.manifest_key(args, cc.directory, fullpath)
+                    if cache is not None else None)
+    deps_path = dst_path + '.deps'
     # pass cpp2c plugin shared library file
-    args.insert(1, f'-fplugin="{cpp2c_so_path}"')
+    args.insert(1, f'-fplugin={cpp2c_so_path}')
+    # tell cpp2c where to write its results
+    args.insert(2, f'-fplugin-arg-macro-types-output={dst_path}')
+    # tell cpp2c where to write the files it read, to key the cache
+    if cache is not None:
+        args.insert(3, f'-fplugin-arg-macro-types-deps={deps_path}')
     # at the very end, specify that we are only doing syntactic analysis
     # so as to not waste time compiling
     args.append('-fsyntax-only')
@@ -124,19 +392,32 @@ def cpp2c(cpp2c_so_path: str,
     ]
     args.extend(ignored_warnings)
 
-    fullpath = os.path.realpath(os.path.join(cc.directory, cc.file))
-    with open(dst_path, 'w') as ofp:
+    if cache is None and os.path.isfile(dst_path):
+        print(f'Skipping {fullpath}, already analyzed')
+    elif cache is not None and cache.lookup(manifest_key, dst_path):
+        print(f'Using cached results for {fullpath}')
+    else:
         print(f'Analyzing macros in {fullpath} ({os.path.getsize(fullpath)} bytes)')
-        # print header information about the analysis file
-        print(f'Src{DELIM}{src_dir}', file=ofp)
-        ofp.flush()
         # change to the directory, then run cpp2c
-        cmd = f"cd \"{cc.directory}\" && {' '.join(args)}"
+        # quote all arguments so that the shell passes them through unchanged
+        cmd = (f"cd {shlex.quote(cc.directory)} && "
+               f"{' '.join(shlex.quote(arg) for arg in args)}")
         print(cmd)
-        p = subprocess.run(cmd, shell=True, text=True, stdout=ofp)
-        if p.stderr:
-            print(p.stderr)
-        p.check_returncode()
+        with budget if budget is not None else contextlib.nullcontext():
+            t0 = time.monotonic()
+            if server is not None:
+                status = server.run(cc.directory, args)
+                if status != 0:
+                    raise subprocess.CalledProcessError(status, cmd)
+            else:
+                p = subprocess.run(cmd, shell=True, text=True)
+                if p.stderr:
+                    print(p.stderr)
+                p.check_returncode()
+            durations[fullpath] = time.monotonic() - t0
+        if cache is not None:
+            cache.store(manifest_key, deps_path, dst_path)
+            os.remove(deps_path)
 
     i[0] += 1
     print(f'macro invocations in {i[0]} / {n} files analyzed', file=sys.stderr)
@@ -149,12 +430,24 @@ def main():
     ap.add_argument('src_dir', type=str)
     ap.add_argument('dst_dir', type=str)
     ap.add_argument('num_processes', type=int)
+    ap.add_argument('--cache_dir', type=str, default=None,
+                    help='directory to cache results in across runs')
+    ap.add_argument('--fork_server', type=str, default=None,
+                    help='path to cpp2c-server, to run cpp2c with instead '
+                    'of starting a new clang process per file')
+    ap.add_argument('--max_rss_mb', type=int, default=None,
+                    help='do not start analyzing another file while the '
+                    'running analyses use more than this many MiB of memory')
     args = ap.parse_args()
 
     cpp2c_so_path: str = os.path.abspath(args.cpp2c_so_path)
     program_dir: str = os.path.abspath(args.program_dir)
     src_dir: str = os.path.abspath(args.src_dir)
     dst_dir: str = os.path.abspath(args.dst_dir)
+    cache = (ResultCache(os.path.abspath(args.cache_dir), cpp2c_so_path)
+             if args.cache_dir is not None else None)
+    server_path: Optional[str] = (os.path.abspath(args.fork_server)
+                                  if args.fork_server is not None else None)
 
     os.chdir(program_dir)
 
@@ -207,13 +500,52 @@ def main():
     for d in dst_dirs:
         os.makedirs(d, exist_ok=True)
 
+    # schedule the most expensive files first, so that a few large files
+    # do not start last and leave a long tail in which most processes idle.
+    # use the time it took to analyze a file in the previous run if there
+    # was one, and estimate it from the file's size otherwise
+    durations_path = os.path.join(dst_dir, DURATIONS_FILE)
+    durations: Dict[str, float] = {}
+    if os.path.isfile(durations_path):
+        with open(durations_path) as fp:
+            durations = json.load(fp)
+    estimates = [estimate_cost(fp) for fp in fullpaths]
+    known = [(durations[fp], e) for fp, e in zip(fullpaths, estimates)
+             if fp in durations]
+    # convert estimates to seconds using the files we have timings for
+    seconds_per_byte = (sum(d for d, _ in known) / sum(e for _, e in known)
+                        if known and sum(e for _, e in known) > 0 else 1.0)
+    costs = [durations.get(fp, e * seconds_per_byte)
+             for fp, e in zip(fullpaths, estimates)]
+    order = sorted(range(n), key=lambda j: costs[j], reverse=True)
+
     # run cpp2c on all files
-    with ThreadPool(args.num_processes) as pool:
-        pool.starmap(cpp2c, zip(repeat(cpp2c_so_path), ccs, repeat(src_dir),
-                                dst_paths, repeat(i), repeat(n)))
+    server = (ForkServer(server_path, cpp2c_so_path, args.num_processes)
+              if server_path is not None else None)
+    budget = (MemoryBudget(args.max_rss_mb * 1024 * 1024)
+              if args.max_rss_mb is not None else None)
+    try:
+        with ThreadPool(args.num_processes) as pool:
+            # hand out one file at a time so that files start in order
+            pool.starmap(cpp2c, zip(repeat(cpp2c_so_path),
+                                    [ccs[j] for j in order],
+                                    repeat(src_dir),
+                                    [dst_paths[j] for j in order],
+                                    repeat(cache), repeat(server),
+                                    repeat(budget), repeat(durations),
+                                    repeat(i), repeat(n)),
+                         chunksize=1)
+    finally:
+        if server is not None:
+            server.close()
+        # record how long each file took, to schedule the next run
+        with open(durations_path, 'w') as fp:
+            json.dump(durations, fp, indent=2, sort_keys=True)
 
     # combine all results into a single file
     with open(os.path.join(dst_dir, 'all_results.cpp2c'), 'w') as ofp:
+        # print header information about the analysis file
+        print(f'Src{DELIM}{src_dir}', file=ofp)
         for dp in dst_paths:
             with open(dp) as ifp:
                 ofp.write(ifp.read())
@@ -15,6 +15,15 @@ def main():
     ap.add_argument('cpp2c_so_path', type=str)
     ap.add_argument('macro_invocation_analysis_time_output_file', type=str)
     ap.add_argument('num_threads', type=int)
+    ap.add_argument('--cache_dir', type=str, default=None,
+                    help='directory to cache results in across runs; '
+                    'programs are re-analyzed even if their results exist')
+    ap.add_argument('--fork_server', type=str, default=None,
+                    help='path to cpp2c-server, to run cpp2c with instead '
+                    'of starting a new clang process per file')
+    ap.add_argument('--max_rss_mb', type=int, default=None,
+                    help='do not start analyzing another file while the '
+                    'running analyses use more than this many MiB of memory')
     args = ap.parse_args()
 
     # create the macro_invocation_analyses directory
@@ -32,12 +41,17 @@ def main():
             src_dir = p_extracted_path + '/' + p.src_dir
             dst_dir = f"./macro_invocation_analyses/{p.name}"
 
-            # TODO: add an option to run programs even if results already exist
-            if os.path.exists(dst_dir):
+            if args.cache_dir is None and os.path.exists(dst_dir):
                 print(f"info: skipping {p.name}, already evaluated")
                 continue
 
             cmd = f'./analyze_macro_invocations_in_program.py "{args.cpp2c_so_path}" "{p_extracted_path}" "{src_dir}" "{dst_dir}" {args.num_threads}'
+            if args.cache_dir is not None:
+                cmd += f' --cache_dir "{os.path.abspath(args.cache_dir)}"'
+            if args.fork_server is not None:
+                cmd += f' --fork_server "{os.path.abspath(args.fork_server)}"'
+            if args.max_rss_mb is not None:
+                cmd += f' --max_rss_mb {args.max_rss_mb}'
             print(cmd)
             t0 = datetime.now()
             run(cmd, shell=True).check_returncode()
@@ -0,0 +1,148 @@
+#include "ASTIndex.hh"
+
+#include "clang/AST/RecursiveASTVisitor.h"
+
+#include "llvm/ADT/STLExtras.h"
+
+namespace cpp2c {
+const ASTIndex::NodeID ASTIndex::None;
+
+// Numbers the nodes of the AST and records their parents.
+// Visits the same nodes as the visitor clang::ParentMapContext builds its map
+// with, so that every node has the same parents as in that map.
+class ASTIndex::Builder : public clang::RecursiveASTVisitor<Builder> {
+    private:
+        using Base = clang::RecursiveASTVisitor<Builder>;
+
+        ASTIndex &Index;
+        const cpp2c::MacroRegions &Regions;
+        // The nodes we are currently inside of, innermost last
+        llvm::SmallVector<NodeID, 16> Stack;
+
+        // Numbers the given node if we have not seen it before, adds the
+        // node on top of the stack to its parents, and pushes it
+        template <typename KeyType>
+        void enter(llvm::DenseMap<KeyType, NodeID> &IDs, KeyType Key,
+                   const clang::DynTypedNode &Node) {
+                auto Res = IDs.insert({ Key, NodeID(Index.Nodes.size()) });
+                auto ID = Res.first->second;
+                auto Parent = Stack.empty() ? None : Stack.back();
+                if (Res.second) {
+                        Index.Nodes.push_back(Node);
+                        Index.Parents.push_back(Parent);
+                } else if (Parent != None) {
+                        if (Index.Parents[ID] == None)
+                                Index.Parents[ID] = Parent;
+                        else if (Index.Parents[ID] != Parent) {
+                                auto &Others = Index.OtherParents[ID];
+                                if (!llvm::is_contained(Others, Parent))
+                                        Others.push_back(Parent);
+                        }
+                }
+                Stack.push_back(ID);
+        }
+
+    public:
+        Builder(ASTIndex &Index, const cpp2c::MacroRegions &Regions)
+                : Index(Index), Regions(Regions) {
+        }
+
+        bool shouldVisitTemplateInstantiations() const {
+                return true;
+        }
+
+        bool shouldVisitImplicitCode() const {
+                return true;
+        }
+
+        bool TraverseDecl(clang::Decl *D) {
+                if (!D || !Regions.mayContainExpansion(*D))
+                        return true;
+                enter(Index.PointerIDs, static_cast<const void *>(D),
+                      clang::DynTypedNode::create(*D));
+                bool Result = Base::TraverseDecl(D);
+                Stack.pop_back();
+                return Result;
+        }
+
+        bool TraverseTypeLoc(clang::TypeLoc TL) {
+                if (!TL || !Regions.mayContainExpansion(TL))
+                        return true;
+                enter(Index.ValueIDs,
+                      std::pair<const void *, const void *>(
+                              TL.getType().getAsOpaquePtr(),
+                              TL.getOpaqueData()),
+                      clang::DynTypedNode::create(TL));
+                bool Result = Base::TraverseTypeLoc(TL);
+                Stack.pop_back();
+                return Result;
+        }
+
+        bool TraverseNestedNameSpecifierLoc(clang::NestedNameSpecifierLoc NNS) {
+                if (!NNS || !Regions.mayContainExpansion(NNS))
+                        return true;
+                enter(Index.ValueIDs,
+                      std::pair<const void *, const void *>(
+                              NNS.getNestedNameSpecifier(),
+                              NNS.getOpaqueData()),
+                      clang::DynTypedNode::create(NNS));
+                bool Result = Base::TraverseNestedNameSpecifierLoc(NNS);
+                Stack.pop_back();
+                return Result;
+        }
+
+        // Stmts are traversed with a work list instead of recursion, so we
+        // enter and leave them in these hooks instead of in TraverseStmt.
+        // Returning false skips the Stmt and its subtree.
+        bool dataTraverseStmtPre(clang::Stmt *ST) {
+                if (!Regions.mayContainExpansion(*ST))
+                        return false;
+                enter(Index.PointerIDs, static_cast<const void *>(ST),
+                      clang::DynTypedNode::create(*ST));
+                return true;
+        }
+
+        bool dataTraverseStmtPost(clang::Stmt *ST) {
+                Stack.pop_back();
+                return true;
+        }
+};
+
+void ASTIndex::build(clang::ASTContext &Ctx,
+                     const cpp2c::MacroRegions &Regions) {
+        clear();
+        Builder(*this, Regions).TraverseAST(Ctx);
+}
+
+void ASTIndex::clear() {
+        // Swap with empty containers so that their memory is freed
+        std::vector<clang::DynTypedNode>().swap(Nodes);
+        std::vector<NodeID>().swap(Parents);
+        OtherParents.shrink_and_clear();
+        PointerIDs.shrink_and_clear();
+        ValueIDs.shrink_and_clear();
+}
+
+ASTIndex::NodeID ASTIndex::idOf(const clang::Stmt &ST) const {
+        auto It = PointerIDs.find(&ST);
+        return It == PointerIDs.end() ? None : It->second;
+}
+
+ASTIndex::NodeID ASTIndex::idOf(const clang::Decl &D) const {
+        auto It = PointerIDs.find(&D);
+        return It == PointerIDs.end() ? None : It->second;
+}
+
+ASTIndex::NodeID ASTIndex::idOf(const clang::TypeLoc &TL) const {
+        auto It = ValueIDs.find(
+                { TL.getType().getAsOpaquePtr(), TL.getOpaqueData() });
+        return It == ValueIDs.end() ? None : It->second;
+}
+
+llvm::ArrayRef<ASTIndex::NodeID> ASTIndex::otherParentsOf(NodeID ID) const {
+        auto It = OtherParents.find(ID);
+        if (It == OtherParents.end())
+                return {};
+        return It->second;
+}
+} // namespace cpp2c
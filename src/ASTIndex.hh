@@ -0,0 +1,94 @@
+#pragma once
+
+#include "PrunedTraversal.hh"
+
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/ASTTypeTraits.h"
+#include "clang/AST/Decl.h"
+#include "clang/AST/Stmt.h"
+#include "clang/AST/TypeLoc.h"
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+
+#include <utility>
+#include <vector>
+
+namespace cpp2c {
+// An index of the AST nodes in the current traversal scope that may contain
+// tokens expanded from macros, built with a single traversal per translation
+// unit.
+// Each node is numbered in the order it is first visited (preorder), and the
+// parents of a node are stored in arrays indexed by its number. The parents
+// are the same as those clang::ParentMapContext finds, but walking up the AST
+// takes one array access per step instead of a hash lookup that returns a
+// vector of DynTypedNodes.
+class ASTIndex {
+    public:
+        using NodeID = unsigned;
+        // The ID of nodes that are not in the index, and the parent of roots
+        static const NodeID None = ~0U;
+
+    private:
+        class Builder;
+
+        // The node with each ID
+        std::vector<clang::DynTypedNode> Nodes;
+        // The first parent of each node
+        std::vector<NodeID> Parents;
+        // The remaining parents of the few nodes with more than one, e.g.,
+        // subexpressions shared by the syntactic and semantic forms of an
+        // initializer list
+        llvm::DenseMap<NodeID, llvm::SmallVector<NodeID, 1> > OtherParents;
+        // The IDs of Stmts and Decls
+        llvm::DenseMap<const void *, NodeID> PointerIDs;
+        // The IDs of nodes that are passed by value, i.e., TypeLocs and
+        // NestedNameSpecifierLocs, keyed by their type and data
+        llvm::DenseMap<std::pair<const void *, const void *>, NodeID> ValueIDs;
+
+    public:
+        // Indexes the nodes in the current traversal scope of the given
+        // context, replacing the previous contents of the index.
+        // Skips the subtrees of nodes that the given regions show cannot
+        // contain an expanded token, since no check walks up from them.
+        void build(clang::ASTContext &Ctx, const cpp2c::MacroRegions &Regions);
+
+        // Frees the contents of the index
+        void clear();
+
+        size_t size() const {
+                return Nodes.size();
+        }
+
+        // Return the ID of the given node, or None if it is not indexed
+        NodeID idOf(const clang::Stmt &ST) const;
+        NodeID idOf(const clang::Decl &D) const;
+        NodeID idOf(const clang::TypeLoc &TL) const;
+
+        const clang::DynTypedNode &node(NodeID ID) const {
+                return Nodes[ID];
+        }
+
+        // Returns the first parent of the given node, or None if it is a
+        // root
+        NodeID parentOf(NodeID ID) const {
+                return Parents[ID];
+        }
+
+        // Returns the parents of the given node after the first
+        llvm::ArrayRef<NodeID> otherParentsOf(NodeID ID) const;
+
+        // Calls F on the ID of every parent of the given node
+        template <typename Fn> void forEachParent(NodeID ID, Fn F) const {
+                auto P = parentOf(ID);
+                if (P == None)
+                        return;
+                F(P);
+                if (OtherParents.empty())
+                        return;
+                for (auto Other : otherParentsOf(ID))
+                        F(Other);
+        }
+};
+} // namespace cpp2c
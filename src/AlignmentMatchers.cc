@@ -1,6 +1,13 @@
 #include "AlignmentMatchers.hh"
 #include "ExpansionMatchHandler.hh"
 
+#include "clang/Basic/LangOptions.h"
+#include "clang/Basic/TokenKinds.h"
+#include "clang/Lex/Token.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+
 namespace cpp2c {
 
 void storeChildren(cpp2c::DeclStmtTypeLoc DSTL,
@@ -44,9 +51,291 @@ void storeChildren(cpp2c::DeclStmtTypeLoc DSTL,
         // }
 }
 
+// Collects the nodes that a pruned traversal visits and that satisfy the
+// given predicate, by kind.
+// Like the matchers this replaces, never collects implicit casts and
+// implicit value initializations.
+template <typename Predicate> class AlignedNodeCollector {
+    private:
+        cpp2c::AlignmentState &State;
+        Predicate Pred;
+
+    public:
+        std::vector<DeclStmtTypeLoc> Stmts, Decls, TypeLocs;
+
+        AlignedNodeCollector(cpp2c::AlignmentState &State, Predicate Pred)
+                : State(State), Pred(Pred) {
+        }
+
+        void operator()(const clang::Stmt &ST) {
+                if (llvm::isa<clang::ImplicitCastExpr>(ST) ||
+                    llvm::isa<clang::ImplicitValueInitExpr>(ST))
+                        return;
+                if (Pred(ST))
+                        Stmts.push_back(DeclStmtTypeLoc(&ST));
+        }
+
+        void operator()(const clang::Decl &D) {
+                if (Pred(D))
+                        Decls.push_back(DeclStmtTypeLoc(&D));
+        }
+
+        void operator()(clang::TypeLoc TL) {
+                if (Pred(TL))
+                        TypeLocs.push_back(DeclStmtTypeLoc(State.keep(TL)));
+        }
+};
+
+// Returns the nodes in the current traversal scope that satisfy the given
+// predicate, found with a single pruned traversal.
+// Each kind of node is matched in the same order as by a MatchFinder, and
+// Stmts come first, then Decls, then TypeLocs, as when matching each kind
+// with its own matcher.
+template <typename Predicate>
+static std::vector<DeclStmtTypeLoc>
+findAlignedNodes(cpp2c::AlignmentState &State, Predicate Pred) {
+        AlignedNodeCollector<Predicate> Collector(State, Pred);
+        traversePruned(State.Ctx, *State.Regions, Collector);
+
+        auto Nodes = std::move(Collector.Stmts);
+        Nodes.insert(Nodes.end(), Collector.Decls.begin(),
+                     Collector.Decls.end());
+        Nodes.insert(Nodes.end(), Collector.TypeLocs.begin(),
+                     Collector.TypeLocs.end());
+        return Nodes;
+}
+
+// The kinds of AST nodes that may align with an expansion
+struct CandidateKinds {
+        bool Exprs = true;
+        bool TypeLocs = true;
+};
+
+// Returns true if the given token is a C keyword that no expression can
+// begin with, and that was never defined as a macro
+static bool isDeclarationKeyword(const clang::Token &Tok) {
+        switch (Tok.getKind()) {
+        case clang::tok::kw_void:
+        case clang::tok::kw_char:
+        case clang::tok::kw_short:
+        case clang::tok::kw_int:
+        case clang::tok::kw_long:
+        case clang::tok::kw_float:
+        case clang::tok::kw_double:
+        case clang::tok::kw_signed:
+        case clang::tok::kw_unsigned:
+        case clang::tok::kw__Bool:
+        case clang::tok::kw__Complex:
+        case clang::tok::kw_struct:
+        case clang::tok::kw_union:
+        case clang::tok::kw_enum:
+        case clang::tok::kw_const:
+        case clang::tok::kw_volatile:
+        case clang::tok::kw_restrict:
+        case clang::tok::kw_typedef:
+        case clang::tok::kw_extern:
+        case clang::tok::kw_static:
+        case clang::tok::kw_register:
+                break;
+        default:
+                return false;
+        }
+        auto II = Tok.getIdentifierInfo();
+        return II && !II->hadMacroDefinition();
+}
+
+// Classifies the first token of the given expansion's definition to find
+// the kinds of nodes that cannot align with it.
+// A node aligns with an expansion only if it begins with the first token of
+// the definition, with the first token of the argument the definition begins
+// with, or with a token expanded from the nested macro the definition begins
+// with. The last two cases require the first token to be an identifier, so
+// if it is not, aligned nodes must begin with that very token, or with a
+// token pasted onto it. In C:
+// - No TypeLoc begins with a literal, or with a punctuator other than a
+//   bracket
+// - No Expr begins with a keyword that only begins declarations
+// We do not classify identifiers, since whether one names a type depends on
+// the scope the macro was invoked in.
+static CandidateKinds candidateKindsOf(const cpp2c::MacroExpansionNode *Exp,
+                                       const clang::LangOptions &LO) {
+        CandidateKinds Kinds;
+        auto &Toks = Exp->DefinitionTokens;
+        if (Toks.empty() || LO.CPlusPlus || LO.ObjC)
+                return Kinds;
+        // Pasting may turn a keyword into an identifier
+        if (Toks.size() > 1 && Toks[1].is(clang::tok::hashhash))
+                return Kinds;
+
+        auto &Front = Toks.front();
+        auto K = Front.getKind();
+        if (clang::tok::isLiteral(K))
+                Kinds.TypeLocs = false;
+        else if (clang::tok::getPunctuatorSpelling(K) &&
+                 !Front.isOneOf(clang::tok::l_paren, clang::tok::l_square))
+                Kinds.TypeLocs = false;
+        else if (isDeclarationKeyword(Front))
+                Kinds.Exprs = false;
+        return Kinds;
+}
+
+static bool mayAlign(const clang::Stmt &ST, CandidateKinds Kinds) {
+        return Kinds.Exprs || !llvm::isa<clang::Expr>(ST);
+}
+
+static bool mayAlign(const clang::Decl &D, CandidateKinds Kinds) {
+        return true;
+}
+
+static bool mayAlign(const clang::TypeLoc &TL, CandidateKinds Kinds) {
+        return Kinds.TypeLocs;
+}
+
+// Finds the AST nodes aligned with the given expansion with a pruned
+// traversal, but not those aligned with its arguments.
+// Only checks the kinds of nodes that the first token of the expansion's
+// definition allows to align with it.
+static void findAlignedASTNodesPruned(cpp2c::MacroExpansionNode *Exp,
+                                      cpp2c::AlignmentState &State) {
+        auto Kinds = candidateKindsOf(Exp, State.Ctx.getLangOpts());
+        Exp->ASTRoots = findAlignedNodes(
+                State, [&State, Exp, Kinds](const auto &Node) {
+                        return mayAlign(Node, Kinds) &&
+                               nodeAlignsWithExpansion(Node, &State, Exp);
+                });
+        Exp->AlignedRoot = (Exp->ASTRoots.size() == 1) ?
+                                   (&(Exp->ASTRoots.front())) :
+                                   nullptr;
+}
+
+// Aligns AST nodes with the arguments of many expansions in one pruned
+// traversal.
+// A node can only be spelled from an argument's tokens if it begins and ends
+// at the file locations of the first and last token, so the arguments are
+// indexed by these locations, and each node is only checked against the
+// arguments indexed by its own.
+// The arguments of different top-level expansions never overlap, so checking
+// each node against these arguments in order aligns the same nodes as
+// traversing the AST once per argument.
+class ArgumentAligner {
+    private:
+        using Offset = clang::SourceLocation::UIntTy;
+        using Indices = llvm::SmallVector<unsigned, 1>;
+
+        // An argument and the nodes aligned with it so far, by kind
+        struct Candidate {
+                cpp2c::MacroExpansionArgument *Arg;
+                std::vector<DeclStmtTypeLoc> Stmts, Decls, TypeLocs;
+        };
+
+        cpp2c::AlignmentState &State;
+        const clang::SourceManager &SM;
+        // In the order the arguments would be aligned one at a time
+        std::vector<Candidate> Candidates;
+        // The candidates whose tokens begin and end at each pair of file
+        // locations
+        llvm::DenseMap<std::pair<Offset, Offset>, Indices> CandidatesByRange;
+
+        // Returns the candidates whose tokens begin and end where the given
+        // node does, if any
+        template <typename NodeType>
+        const Indices *candidatesFor(const NodeType &Node) {
+                auto B = SM.getFileLoc(Node.getBeginLoc());
+                auto E = SM.getFileLoc(Node.getEndLoc());
+                if (B.isInvalid() || E.isInvalid())
+                        return nullptr;
+                auto It = CandidatesByRange.find(
+                        { B.getRawEncoding(), E.getRawEncoding() });
+                return It == CandidatesByRange.end() ? nullptr : &It->second;
+        }
+
+        // Checks the given node against its candidates, and returns the
+        // indices of those it aligned with
+        template <typename NodeType> Indices align(const NodeType &Node) {
+                Indices Aligned;
+                if (auto Matching = candidatesFor(Node))
+                        for (auto I : *Matching)
+                                if (nodeIsSpelledFromTokens(
+                                            Node, &State,
+                                            Candidates[I].Arg->Tokens))
+                                        Aligned.push_back(I);
+                return Aligned;
+        }
+
+    public:
+        ArgumentAligner(cpp2c::AlignmentState &State)
+                : State(State), SM(State.Ctx.getSourceManager()) {
+        }
+
+        void addArgument(cpp2c::MacroExpansionArgument &Arg) {
+                // Nodes cannot be spelled from no tokens
+                if (Arg.Tokens.empty())
+                        return;
+                auto B = SM.getFileLoc(Arg.Tokens.front().getLocation());
+                auto E = SM.getFileLoc(Arg.Tokens.back().getLocation());
+                if (B.isInvalid() || E.isInvalid())
+                        return;
+                CandidatesByRange[{ B.getRawEncoding(), E.getRawEncoding() }]
+                        .push_back(Candidates.size());
+                Candidates.push_back({ &Arg, {}, {}, {} });
+        }
+
+        void operator()(const clang::Stmt &ST) {
+                if (llvm::isa<clang::ImplicitCastExpr>(ST) ||
+                    llvm::isa<clang::ImplicitValueInitExpr>(ST))
+                        return;
+                for (auto I : align(ST))
+                        Candidates[I].Stmts.push_back(DeclStmtTypeLoc(&ST));
+        }
+
+        void operator()(const clang::Decl &D) {
+                for (auto I : align(D))
+                        Candidates[I].Decls.push_back(DeclStmtTypeLoc(&D));
+        }
+
+        void operator()(clang::TypeLoc TL) {
+                for (auto I : align(TL))
+                        Candidates[I].TypeLocs.push_back(
+                                DeclStmtTypeLoc(State.keep(TL)));
+        }
+
+        // Sets the aligned roots of every argument, with Stmts first, then
+        // Decls, then TypeLocs, as when matching each kind separately
+        void finish() {
+                for (auto &&C : Candidates) {
+                        auto &Roots = C.Arg->AlignedRoots;
+                        Roots = std::move(C.Stmts);
+                        Roots.insert(Roots.end(), C.Decls.begin(),
+                                     C.Decls.end());
+                        Roots.insert(Roots.end(), C.TypeLocs.begin(),
+                                     C.TypeLocs.end());
+                }
+        }
+};
+
+// Aligns AST nodes with the arguments of the given expansions with one pruned
+// traversal
+static void findAlignedASTNodesForArgumentsPruned(
+        std::vector<cpp2c::MacroExpansionNode *> &Exps,
+        cpp2c::AlignmentState &State) {
+        ArgumentAligner Aligner(State);
+        for (auto &&Exp : Exps)
+                for (auto &&Arg : Exp->Arguments)
+                        Aligner.addArgument(Arg);
+        traversePruned(State.Ctx, *State.Regions, Aligner);
+        Aligner.finish();
+}
+
 void findAlignedASTNodesForExpansion(cpp2c::MacroExpansionNode *Exp,
-                                     clang::ASTContext &Ctx) {
+                                     cpp2c::AlignmentState &State) {
         using namespace clang::ast_matchers;
+        auto &Ctx = State.Ctx;
+        if (State.Regions) {
+                findAlignedASTNodesPruned(Exp, State);
+                std::vector<cpp2c::MacroExpansionNode *> Exps = { Exp };
+                return findAlignedASTNodesForArgumentsPruned(Exps, State);
+        }
+
         // Find AST nodes aligned with the entire invocation
 
         // Match stmts
@@ -55,7 +344,7 @@ void findAlignedASTNodesForExpansion(cpp2c::MacroExpansionNode *Exp,
                 ExpansionMatchHandler Handler;
                 auto Matcher = stmt(unless(anyOf(implicitCastExpr(),
                                                  implicitValueInitExpr())),
-                                    alignsWithExpansion(&Ctx, Exp))
+                                    alignsWithExpansion(&State, Exp))
                                        .bind("root");
                 Finder.addMatcher(Matcher, &Handler);
                 Finder.matchAST(Ctx);
@@ -68,7 +357,7 @@ void findAlignedASTNodesForExpansion(cpp2c::MacroExpansionNode *Exp,
                 MatchFinder Finder;
                 ExpansionMatchHandler Handler;
                 auto Matcher =
-                        decl(alignsWithExpansion(&Ctx, Exp)).bind("root");
+                        decl(alignsWithExpansion(&State, Exp)).bind("root");
                 Finder.addMatcher(Matcher, &Handler);
                 Finder.matchAST(Ctx);
                 for (auto &&M : Handler.Matches)
@@ -80,7 +369,7 @@ void findAlignedASTNodesForExpansion(cpp2c::MacroExpansionNode *Exp,
                 MatchFinder Finder;
                 ExpansionMatchHandler Handler;
                 auto Matcher =
-                        typeLoc(alignsWithExpansion(&Ctx, (Exp))).bind("root");
+                        typeLoc(alignsWithExpansion(&State, Exp)).bind("root");
                 Finder.addMatcher(Matcher, &Handler);
                 Finder.matchAST(Ctx);
                 for (auto &&M : Handler.Matches)
@@ -103,7 +392,7 @@ void findAlignedASTNodesForExpansion(cpp2c::MacroExpansionNode *Exp,
                         auto Matcher =
                                 stmt(unless(anyOf(implicitCastExpr(),
                                                   implicitValueInitExpr())),
-                                     isSpelledFromTokens(&Ctx, Arg.Tokens))
+                                     isSpelledFromTokens(&State, Arg.Tokens))
                                         .bind("root");
                         Finder.addMatcher(Matcher, &Handler);
                         Finder.matchAST(Ctx);
@@ -116,7 +405,7 @@ void findAlignedASTNodesForExpansion(cpp2c::MacroExpansionNode *Exp,
                         MatchFinder Finder;
                         ExpansionMatchHandler Handler;
                         auto Matcher =
-                                decl(isSpelledFromTokens(&Ctx, Arg.Tokens))
+                                decl(isSpelledFromTokens(&State, Arg.Tokens))
                                         .bind("root");
                         Finder.addMatcher(Matcher, &Handler);
                         Finder.matchAST(Ctx);
@@ -129,7 +418,7 @@ void findAlignedASTNodesForExpansion(cpp2c::MacroExpansionNode *Exp,
                         MatchFinder Finder;
                         ExpansionMatchHandler Handler;
                         auto Matcher =
-                                typeLoc(isSpelledFromTokens(&Ctx, Arg.Tokens))
+                                typeLoc(isSpelledFromTokens(&State, Arg.Tokens))
                                         .bind("root");
                         Finder.addMatcher(Matcher, &Handler);
                         Finder.matchAST(Ctx);
@@ -138,4 +427,21 @@ void findAlignedASTNodesForExpansion(cpp2c::MacroExpansionNode *Exp,
                 }
         }
 }
+
+void findAlignedASTNodesForExpansions(
+        std::vector<cpp2c::MacroExpansionNode *> &Exps,
+        cpp2c::AlignmentState &State) {
+        if (!State.Regions) {
+                for (auto &&Exp : Exps)
+                        findAlignedASTNodesForExpansion(Exp, State);
+                return;
+        }
+
+        // Nodes are aligned with expansions and with arguments independently,
+        // so align all expansions first, and then all of their arguments at
+        // once
+        for (auto &&Exp : Exps)
+                findAlignedASTNodesPruned(Exp, State);
+        findAlignedASTNodesForArgumentsPruned(Exps, State);
+}
 } // namespace cpp2c
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "AlignmentState.hh"
 #include "DeclStmtTypeLoc.hh"
 #include "MacroExpansionNode.hh"
 
@@ -17,15 +18,15 @@ void storeChildren(cpp2c::DeclStmtTypeLoc DSTL,
                    std::set<const clang::Decl *> &MatchedDecls,
                    std::set<const clang::TypeLoc *> &MatchedTypeLocs);
 
-// Matches all AST nodes that align perfectly with the body of the given
-// macro expansion.
+// Returns true if the given AST node aligns perfectly with the body of the
+// given macro expansion, and records it as aligned if so.
 // Only tested to work with top-level, non-argument expansions.
-AST_POLYMORPHIC_MATCHER_P2(alignsWithExpansion,
-                           AST_POLYMORPHIC_SUPPORTED_TYPES(clang::Decl,
-                                                           clang::Stmt,
-                                                           clang::TypeLoc),
-                           clang::ASTContext *, Ctx,
-                           cpp2c::MacroExpansionNode *, Expansion) {
+template <typename NodeType>
+bool nodeAlignsWithExpansion(const NodeType &Node,
+                             cpp2c::AlignmentState *State,
+                             cpp2c::MacroExpansionNode *Expansion) {
+        auto Ctx = &State->Ctx;
+
         // Can't match an expansion with no tokens
         if (Expansion->DefinitionTokens.empty())
                 return false;
@@ -41,27 +42,31 @@ AST_POLYMORPHIC_MATCHER_P2(alignsWithExpansion,
 
         // These sets keep track of nodes we have already matched,
         // so that we do not match their subtrees as well
-        static std::set<const clang::Stmt *> MatchedStmts;
-        static std::set<const clang::Decl *> MatchedDecls;
-        static std::set<const clang::TypeLoc *> MatchedTypeLocs;
+        auto &Matched = State->template expansionNodes<NodeType>();
+        auto &MatchedStmts = Matched.Stmts;
+        auto &MatchedDecls = Matched.Decls;
+        auto &MatchedTypeLocs = Matched.TypeLocs;
 
         // Collect a bunch of SourceLocation information up front that may be
         // useful later
 
         auto &SM = Ctx->getSourceManager();
-
-        auto NodeSpB = SM.getSpellingLoc(Node.getBeginLoc());
-        auto NodeSpE = SM.getSpellingLoc(Node.getEndLoc());
-        auto NodeExB = SM.getExpansionLoc(Node.getBeginLoc());
-        auto NodeExE = SM.getExpansionLoc(Node.getEndLoc());
-        auto ImmMacroCallerLocSpB = SM.getSpellingLoc(
-                SM.getImmediateMacroCallerLoc(Node.getBeginLoc()));
-        auto ImmMacroCallerLocSpE = SM.getSpellingLoc(
-                SM.getImmediateMacroCallerLoc(Node.getEndLoc()));
-        auto ImmMacroCallerLocExB = SM.getExpansionLoc(
-                SM.getImmediateMacroCallerLoc(Node.getBeginLoc()));
-        auto ImmMacroCallerLocExE = SM.getExpansionLoc(
-                SM.getImmediateMacroCallerLoc(Node.getEndLoc()));
+        // Every node is checked against every expansion, so the fast engine
+        // caches what their locations resolve to
+        auto &Locs = State->Locations;
+
+        auto NodeSpB = Locs.getSpellingLoc(Node.getBeginLoc());
+        auto NodeSpE = Locs.getSpellingLoc(Node.getEndLoc());
+        auto NodeExB = Locs.getExpansionLoc(Node.getBeginLoc());
+        auto NodeExE = Locs.getExpansionLoc(Node.getEndLoc());
+        auto ImmMacroCallerLocSpB = Locs.getSpellingLoc(
+                Locs.getImmediateMacroCallerLoc(Node.getBeginLoc()));
+        auto ImmMacroCallerLocSpE = Locs.getSpellingLoc(
+                Locs.getImmediateMacroCallerLoc(Node.getEndLoc()));
+        auto ImmMacroCallerLocExB = Locs.getExpansionLoc(
+                Locs.getImmediateMacroCallerLoc(Node.getBeginLoc()));
+        auto ImmMacroCallerLocExE = Locs.getExpansionLoc(
+                Locs.getImmediateMacroCallerLoc(Node.getEndLoc()));
         DeclStmtTypeLoc DSTL(&Node);
 
         static const constexpr bool debug = false;
@@ -118,7 +123,7 @@ AST_POLYMORPHIC_MATCHER_P2(alignsWithExpansion,
                 if (!Arg->Tokens.empty()) {
                         auto L = Arg->Tokens.front().getLocation();
                         if (L.isValid())
-                                ArgB = SM.getSpellingLoc(L);
+                                ArgB = Locs.getSpellingLoc(L);
                 }
         }
         clang::SourceLocation ArgE;
@@ -126,22 +131,15 @@ AST_POLYMORPHIC_MATCHER_P2(alignsWithExpansion,
                 if (!Arg->Tokens.empty()) {
                         auto L = Arg->Tokens.back().getLocation();
                         if (L.isValid())
-                                ArgE = SM.getSpellingLoc(L);
+                                ArgE = Locs.getSpellingLoc(L);
                 }
         }
 
         // Set up case 3
-        clang::SourceLocation B = Node.getBeginLoc();
-        while (SM.getImmediateMacroCallerLoc(B).isMacroID() &&
-               SM.getImmediateMacroCallerLoc(B).isValid())
-                B = SM.getImmediateMacroCallerLoc(B);
-        B = SM.getSpellingLoc(B);
-
-        clang::SourceLocation E = Node.getEndLoc();
-        while (SM.getImmediateMacroCallerLoc(E).isMacroID() &&
-               SM.getImmediateMacroCallerLoc(E).isValid())
-                E = SM.getImmediateMacroCallerLoc(E);
-        E = SM.getSpellingLoc(E);
+        clang::SourceLocation B = Locs.getSpellingLoc(
+                Locs.getOutermostMacroCallerLoc(Node.getBeginLoc()));
+        clang::SourceLocation E = Locs.getSpellingLoc(
+                Locs.getOutermostMacroCallerLoc(Node.getEndLoc()));
 
         bool frontAligned =
                 // Case 1
@@ -299,18 +297,26 @@ AST_POLYMORPHIC_MATCHER_P2(alignsWithExpansion,
         // Check that this node is not a proper subtree of an aligned node
         // that we already found.
         bool foundParentBefore = false;
-        for (auto P : Ctx->getParents(Node)) {
-                if (auto PST = P.template get<clang::Stmt>()) {
+        auto CheckParent = [&](const clang::DynTypedNode &P) {
+                if (auto PST = P.get<clang::Stmt>()) {
                         if (MatchedStmts.find(PST) != MatchedStmts.end())
                                 foundParentBefore = true;
-                } else if (auto DP = P.template get<clang::Decl>()) {
+                } else if (auto DP = P.get<clang::Decl>()) {
                         if (MatchedDecls.find(DP) != MatchedDecls.end())
                                 foundParentBefore = true;
-                } else if (auto DTL = P.template get<clang::TypeLoc>()) {
+                } else if (auto DTL = P.get<clang::TypeLoc>()) {
                         if (MatchedTypeLocs.find(DTL) != MatchedTypeLocs.end())
                                 foundParentBefore = true;
                 }
-        }
+        };
+        auto ID = State->Index ? State->Index->idOf(Node) : ASTIndex::None;
+        if (ID != ASTIndex::None)
+                State->Index->forEachParent(ID, [&](ASTIndex::NodeID P) {
+                        CheckParent(State->Index->node(P));
+                });
+        else
+                for (auto P : Ctx->getParents(Node))
+                        CheckParent(P);
         if (foundParentBefore) {
                 if (debug) {
                         llvm::errs() << "Found parent before\n";
@@ -339,15 +345,27 @@ AST_POLYMORPHIC_MATCHER_P2(alignsWithExpansion,
         return true;
 }
 
-// Matches all AST nodes who span the same range that the
-// given token list spans, and for whose range every token
-// in the list is spelled
-AST_POLYMORPHIC_MATCHER_P2(isSpelledFromTokens,
+// Matches all AST nodes that align perfectly with the body of the given
+// macro expansion.
+// Only tested to work with top-level, non-argument expansions.
+AST_POLYMORPHIC_MATCHER_P2(alignsWithExpansion,
                            AST_POLYMORPHIC_SUPPORTED_TYPES(clang::Decl,
                                                            clang::Stmt,
                                                            clang::TypeLoc),
-                           clang::ASTContext *, Ctx, std::vector<clang::Token>,
-                           Tokens) {
+                           cpp2c::AlignmentState *, State,
+                           cpp2c::MacroExpansionNode *, Expansion) {
+        return nodeAlignsWithExpansion(Node, State, Expansion);
+}
+
+// Returns true if the given AST node spans the same range that the
+// given token list spans, and every token in the list is spelled in its
+// range, and records it as aligned if so
+template <typename NodeType>
+bool nodeIsSpelledFromTokens(const NodeType &Node,
+                             cpp2c::AlignmentState *State,
+                             const std::vector<clang::Token> &Tokens) {
+        auto Ctx = &State->Ctx;
+
         // First ensure that the token list is not empty, because if it is,
         // then of course it is impossible for a node to be spelled from an
         // empty token list.
@@ -375,9 +393,10 @@ AST_POLYMORPHIC_MATCHER_P2(isSpelledFromTokens,
 
         // These sets keep track of nodes we have already matched,
         // so that we do not match their subtrees as well
-        static std::set<const clang::Stmt *> MatchedStmts;
-        static std::set<const clang::Decl *> MatchedDecls;
-        static std::set<const clang::TypeLoc *> MatchedTypeLocs;
+        auto &Matched = State->template argumentNodes<NodeType>();
+        auto &MatchedStmts = Matched.Stmts;
+        auto &MatchedDecls = Matched.Decls;
+        auto &MatchedTypeLocs = Matched.TypeLocs;
 
         static const constexpr bool debug = false;
 
@@ -536,6 +555,26 @@ AST_POLYMORPHIC_MATCHER_P2(isSpelledFromTokens,
         return true;
 }
 
+// Matches all AST nodes who span the same range that the
+// given token list spans, and for whose range every token
+// in the list is spelled
+AST_POLYMORPHIC_MATCHER_P2(isSpelledFromTokens,
+                           AST_POLYMORPHIC_SUPPORTED_TYPES(clang::Decl,
+                                                           clang::Stmt,
+                                                           clang::TypeLoc),
+                           cpp2c::AlignmentState *, State,
+                           std::vector<clang::Token>, Tokens) {
+        return nodeIsSpelledFromTokens(Node, State, Tokens);
+}
+
+// Finds the AST nodes aligned with the given expansion and its arguments.
+// Nodes already aligned with an expansion in the given state are skipped.
 void findAlignedASTNodesForExpansion(cpp2c::MacroExpansionNode *Exp,
-                                     clang::ASTContext &Ctx);
+                                     cpp2c::AlignmentState &State);
+
+// Finds the AST nodes aligned with each of the given top-level expansions and
+// their arguments, in order
+void findAlignedASTNodesForExpansions(
+        std::vector<cpp2c::MacroExpansionNode *> &Exps,
+        cpp2c::AlignmentState &State);
 }
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "ASTIndex.hh"
+#include "LocationCache.hh"
+#include "PrunedTraversal.hh"
+
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "clang/AST/Stmt.h"
+#include "clang/AST/TypeLoc.h"
+
+#include <deque>
+#include <set>
+#include <type_traits>
+
+namespace cpp2c {
+// AST nodes that an alignment matcher has already matched
+struct MatchedNodes {
+        std::set<const clang::Stmt *> Stmts;
+        std::set<const clang::Decl *> Decls;
+        std::set<const clang::TypeLoc *> TypeLocs;
+};
+
+// The state the alignment matchers keep while aligning the expansions of one
+// translation unit.
+// Once a node has been aligned with an expansion or an argument, neither it
+// nor its subtrees may be aligned again. Each matcher tracks this separately
+// for each kind of node it matches.
+class AlignmentState {
+    private:
+        MatchedNodes ExpansionNodes[3];
+        MatchedNodes ArgumentNodes[3];
+        // Copies of the TypeLocs found by pruned traversals, which pass them
+        // by value
+        std::deque<clang::TypeLoc> TypeLocs;
+
+        template <typename NodeType> static constexpr unsigned kindIndex() {
+                return std::is_same<NodeType, clang::Stmt>::value ? 0 :
+                       std::is_same<NodeType, clang::Decl>::value ? 1 :
+                                                                    2;
+        }
+
+    public:
+        clang::ASTContext &Ctx;
+        // If set, the parents of nodes are looked up in this index instead
+        // of in the parent map of the AST context
+        const cpp2c::ASTIndex *Index = nullptr;
+        // Resolves the locations of nodes for alignsWithExpansion, and only
+        // caches them if enabled
+        cpp2c::LocationCache Locations;
+        // If set, nodes are aligned with a single traversal that skips the
+        // subtrees these regions show contain no expanded tokens, instead of
+        // with AST matchers
+        const cpp2c::MacroRegions *Regions = nullptr;
+
+        AlignmentState(clang::ASTContext &Ctx)
+                : Ctx(Ctx), Locations(Ctx.getSourceManager()) {
+        }
+
+        // The nodes of the given kind that alignsWithExpansion has matched
+        template <typename NodeType> MatchedNodes &expansionNodes() {
+                return ExpansionNodes[kindIndex<NodeType>()];
+        }
+
+        // The nodes of the given kind that isSpelledFromTokens has matched
+        template <typename NodeType> MatchedNodes &argumentNodes() {
+                return ArgumentNodes[kindIndex<NodeType>()];
+        }
+
+        // Returns a copy of the given TypeLoc that lives as long as this
+        // state does
+        const clang::TypeLoc *keep(clang::TypeLoc TL) {
+                TypeLocs.push_back(TL);
+                return &TypeLocs.back();
+        }
+};
+} // namespace cpp2c
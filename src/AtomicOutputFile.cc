@@ -0,0 +1,51 @@
+#include "AtomicOutputFile.hh"
+
+#include "llvm/Support/FileSystem.h"
+
+#include "assert.h"
+
+namespace cpp2c {
+std::error_code AtomicOutputFile::open(llvm::StringRef Path) {
+        this->Path = Path.str();
+
+        // Create the temporary file in the same directory as the destination
+        // so that renaming it is atomic
+        int FD;
+        if (auto EC = llvm::sys::fs::createUniqueFile(Path + "-%%%%%%%%.tmp",
+                                                      FD, TempPath))
+                return EC;
+
+        OS = std::make_unique<llvm::raw_fd_ostream>(FD, true);
+        OS->SetBufferSize(BufferSize);
+        return std::error_code();
+}
+
+llvm::raw_ostream &AtomicOutputFile::os() {
+        assert(OS && "Output file was not opened");
+        return *OS;
+}
+
+std::error_code AtomicOutputFile::commit() {
+        assert(OS && "Output file was not opened");
+        OS->close();
+        auto EC = OS->error();
+        OS->clear_error();
+        OS.reset();
+        if (EC)
+                return EC;
+
+        EC = llvm::sys::fs::rename(TempPath, Path);
+        if (!EC)
+                TempPath.clear();
+        return EC;
+}
+
+AtomicOutputFile::~AtomicOutputFile() {
+        if (OS) {
+                OS->close();
+                OS->clear_error();
+        }
+        if (!TempPath.empty())
+                llvm::sys::fs::remove(TempPath);
+}
+} // namespace cpp2c
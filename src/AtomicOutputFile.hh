@@ -0,0 +1,46 @@
+#pragma once
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <memory>
+#include <string>
+#include <system_error>
+
+namespace cpp2c {
+// An output file that is first written to a temporary file in the same
+// directory as its destination, and only renamed to its destination once
+// it has been written completely.
+// This way the destination either does not exist or contains complete
+// results, even if the process is killed partway through writing.
+class AtomicOutputFile {
+    private:
+        std::string Path;
+        llvm::SmallString<128> TempPath;
+        std::unique_ptr<llvm::raw_fd_ostream> OS;
+
+    public:
+        // Size of the buffer placed in front of the temporary file
+        static const constexpr size_t BufferSize = 1 << 20;
+
+        // Creates the temporary file for the given destination path
+        std::error_code open(llvm::StringRef Path);
+
+        // Returns whether the file has been opened and not yet committed
+        bool isOpen() const {
+                return OS != nullptr;
+        }
+
+        // Returns the stream to write results to.
+        // Only valid after a successful call to open().
+        llvm::raw_ostream &os();
+
+        // Flushes and closes the temporary file, and renames it to the
+        // destination path
+        std::error_code commit();
+
+        // Removes the temporary file if it was never committed
+        ~AtomicOutputFile();
+};
+} // namespace cpp2c
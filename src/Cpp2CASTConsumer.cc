@@ -6,7 +6,10 @@
 #include "ExpansionMatchHandler.hh"
 #include "IncludeCollector.hh"
 #include "Logging.hh"
+#include "PrunedTraversal.hh"
+#include "RangeMaximumTable.hh"
 #include "StmtCollectorMatchHandler.hh"
+#include "SubtreeIndex.hh"
 
 #include "clang/ASTMatchers/ASTMatchFinder.h"
 #include "clang/ASTMatchers/ASTMatchers.h"
@@ -17,6 +20,7 @@
 #include <functional>
 #include <queue>
 #include <set>
+#include <string>
 
 #include "assert.h"
 
@@ -26,11 +30,11 @@
 namespace cpp2c {
 using namespace clang::ast_matchers;
 
-// Collect all subtrees of the given stmt using BFS
-std::set<const clang::Stmt *> subtrees(const clang::Stmt *ST) {
-        std::set<const clang::Stmt *> Subtrees;
+// Inserts all subtrees of the given stmt into the given set using BFS
+void insertSubtrees(const clang::Stmt *ST,
+                    std::set<const clang::Stmt *> &Subtrees) {
         if (!ST)
-                return Subtrees;
+                return;
 
         std::queue<const clang::Stmt *> Q({ ST });
         while (!Q.empty()) {
@@ -42,7 +46,28 @@ std::set<const clang::Stmt *> subtrees(const clang::Stmt *ST) {
                                 Q.push(Child);
                 }
         }
-        return Subtrees;
+}
+
+// Inserts all subtrees of the given stmt into the given set using BFS, and
+// maps each of them to its parent, and the given stmt to null
+void insertSubtrees(
+        const clang::Stmt *ST, std::set<const clang::Stmt *> &Subtrees,
+        llvm::DenseMap<const clang::Stmt *, const clang::Stmt *> &Parents) {
+        if (!ST)
+                return;
+
+        Parents.try_emplace(ST, nullptr);
+        std::queue<const clang::Stmt *> Q({ ST });
+        while (!Q.empty()) {
+                auto Cur = Q.front();
+                Q.pop();
+                Subtrees.insert(Cur);
+                for (auto &&Child : Cur->children())
+                        if (Child) {
+                                Parents.try_emplace(Child, Cur);
+                                Q.push(Child);
+                        }
+        }
 }
 
 clang::Expr *skipImplicitAndParens(clang::Expr *E) {
@@ -98,6 +123,23 @@ clang::Decl *getTypeDeclOrNull(const clang::Type *T) {
                 return nullptr;
 }
 
+// Returns true if D was declared after L
+bool isDeclaredAfter(clang::SourceManager &SM, const clang::Decl *D,
+                     clang::SourceLocation L) {
+        if (!D)
+                return false;
+
+        auto DLoc = D->getLocation();
+        if (DLoc.isInvalid())
+                return false;
+
+        auto DFLoc = SM.getFileLoc(DLoc);
+        if (DFLoc.isInvalid())
+                return false;
+
+        return SM.isBeforeInTranslationUnit(L, DFLoc);
+}
+
 // Returns true if any type in T was defined after L
 bool hasTypeDefinedAfter(const clang::Type *T, clang::ASTContext &Ctx,
                          clang::SourceLocation L) {
@@ -106,20 +148,7 @@ bool hasTypeDefinedAfter(const clang::Type *T, clang::ASTContext &Ctx,
                 if (!T)
                         return false;
 
-                auto *D = getTypeDeclOrNull(T);
-
-                if (!D)
-                        return false;
-
-                auto DLoc = D->getLocation();
-                if (DLoc.isInvalid())
-                        return false;
-
-                auto DFLoc = SM.getFileLoc(DLoc);
-                if (DFLoc.isInvalid())
-                        return false;
-
-                return SM.isBeforeInTranslationUnit(L, DFLoc);
+                return isDeclaredAfter(SM, getTypeDeclOrNull(T), L);
         });
 }
 
@@ -157,6 +186,27 @@ bool hasLocalType(const clang::Type *T, clang::ASTContext &Ctx) {
         });
 }
 
+// Returns true if N is a Stmt or Decl whose subexpressions must be integral
+// constant expressions
+static bool requiresICE(const clang::DynTypedNode &N) {
+        if (N.get<clang::CaseStmt>() || N.get<clang::EnumDecl>())
+                return true;
+
+        if (auto FD = N.get<clang::FieldDecl>())
+                if (FD->isBitField())
+                        return true;
+
+        if (auto VD = N.get<clang::VarDecl>()) {
+                auto QT = VD->getType();
+                if (!QT.isNull()) {
+                        if (auto T = QT.getTypePtrOrNull())
+                                if (T->isArrayType())
+                                        return true;
+                }
+        }
+        return false;
+}
+
 // Returns true if ST is a descendant of a Stmt which can only have
 // subexpressions that are integral constants expressions
 bool isDescendantOfStmtRequiringICE(clang::ASTContext &Ctx,
@@ -171,28 +221,42 @@ bool isDescendantOfStmtRequiringICE(clang::ASTContext &Ctx,
                 auto Cur = Q.front();
                 Q.pop();
 
-                if (Cur.get<clang::CaseStmt>() || Cur.get<clang::EnumDecl>())
+                if (requiresICE(Cur))
                         return true;
 
-                if (auto FD = Cur.get<clang::FieldDecl>())
-                        if (FD->isBitField())
-                                return true;
-
-                if (auto VD = Cur.get<clang::VarDecl>()) {
-                        auto QT = VD->getType();
-                        if (!QT.isNull()) {
-                                if (auto T = QT.getTypePtrOrNull())
-                                        if (T->isArrayType())
-                                                return true;
-                        }
-                }
-
                 for (auto P : Ctx.getParents(Cur))
                         Q.push(P);
         }
         return false;
 }
 
+// Same as above, but walks up the AST with the parents in the given index.
+// Falls back to the parent map of the AST context if ST is not indexed.
+bool isDescendantOfStmtRequiringICE(clang::ASTContext &Ctx,
+                                    const cpp2c::ASTIndex &Index,
+                                    const clang::Stmt *ST) {
+        if (!ST)
+                return false;
+
+        auto ID = Index.idOf(*ST);
+        if (ID == ASTIndex::None)
+                return isDescendantOfStmtRequiringICE(Ctx, ST);
+
+        std::queue<ASTIndex::NodeID> Q;
+        Index.forEachParent(ID, [&Q](ASTIndex::NodeID P) { Q.push(P); });
+        while (!Q.empty()) {
+                auto Cur = Q.front();
+                Q.pop();
+
+                if (requiresICE(Index.node(Cur)))
+                        return true;
+
+                Index.forEachParent(Cur,
+                                    [&Q](ASTIndex::NodeID P) { Q.push(P); });
+        }
+        return false;
+}
+
 // Tries to get the full real path and line + column number for a given
 // source location.
 // First element is whether the operation was successful, the second
@@ -311,133 +375,155 @@ isGlobalInclude(clang::SourceManager &SM, const clang::LangOptions &LO,
         return { true, IncludedFileRealpath };
 }
 
-Cpp2CASTConsumer::Cpp2CASTConsumer(clang::CompilerInstance &CI) {
-        clang::Preprocessor &PP = CI.getPreprocessor();
-        clang::ASTContext &Ctx = CI.getASTContext();
-
-        MF = new cpp2c::MacroForest(PP, Ctx);
-        IC = new cpp2c::IncludeCollector();
-        DC = new cpp2c::DefinitionInfoCollector(Ctx);
-
-        PP.addPPCallbacks(std::unique_ptr<cpp2c::MacroForest>(MF));
-        PP.addPPCallbacks(std::unique_ptr<cpp2c::IncludeCollector>(IC));
-        PP.addPPCallbacks(std::unique_ptr<cpp2c::DefinitionInfoCollector>(DC));
+// Sets of AST nodes that are used for checking whether properties are
+// satisfied
+struct ASTNodeSets {
+        // Any reference to a decl
+        std::set<const clang::DeclRefExpr *> AllDeclRefExprs;
+        // Any reference to a decl declared at a local scope
+        std::set<const clang::DeclRefExpr *> DeclRefExprsOfLocallyDefinedDecls;
+        // Any expr with side-effects
+        // Binary assignment expressions, Pre/Post Inc/Dec
+        std::set<const clang::Expr *> SideEffectExprs;
+        // Any expr that is the modified part of an expression with side-effects
+        std::set<clang::Expr *> SideEffectExprsLHSs;
+        // Any expr that is an address-of expr
+        std::set<const clang::UnaryOperator *> AddressOfExprs;
+        // Any expr that is the operand of an expression with short-circuiting.
+        // ConditionalOperator, LogicalAnd, LogicalOr
+        std::set<const clang::Expr *> ConditionalExprs;
+        // Any expr with a type defined at a local scope
+        std::set<const clang::Expr *> ExprsWithLocallyDefinedTypes;
+        // Whether the subtree of each Stmt under a Stmt aligned with an
+        // expansion or argument contains a jump statement.
+        // Only filled if SummarizedJumps is set.
+        llvm::DenseMap<const clang::Stmt *, bool> SubtreeContainsJump;
+        bool SummarizedJumps = false;
+        // The Stmts under the Stmts aligned with expansions and arguments,
+        // labeled with the sets above they are in.
+        // Only filled if IndexedSubtrees is set.
+        cpp2c::SubtreeIndex Subtrees;
+        bool IndexedSubtrees = false;
+        // For each indexed Stmt, one more than the rank of the file location
+        // of the decl it refers to among those of all indexed DeclRefExprs,
+        // in translation unit order, or 0 if it is not a DeclRefExpr.
+        // Only filled if RankedDecls is set.
+        cpp2c::RangeMaximumTable DeclRanks;
+        bool RankedDecls = false;
+};
+
+// The labels of Stmts in ASTNodeSets::Subtrees
+enum SubtreeLabel {
+        DeclRefLabel,
+        LocalDeclRefLabel,
+        SideEffectLabel,
+        // The operand modified by a side-effect expression, without parens
+        // and implicit casts
+        ModifiedOperandLabel,
+        AddressOfLabel,
+        // The operand of an address-of expression, without parens and
+        // implicit casts
+        AddressedOperandLabel,
+        LocalTypeLabel,
+        // A DeclRefExpr whose decl has no valid file location, and so cannot
+        // be ranked
+        UnrankedDeclRefLabel,
+};
+
+static bool isJump(const clang::Stmt *St) {
+        return llvm::isa_and_nonnull<clang::ReturnStmt>(St) ||
+               llvm::isa_and_nonnull<clang::ContinueStmt>(St) ||
+               llvm::isa_and_nonnull<clang::BreakStmt>(St) ||
+               llvm::isa_and_nonnull<clang::GotoStmt>(St);
 }
 
-void Cpp2CASTConsumer::HandleTranslationUnit(clang::ASTContext &Ctx) {
-        auto &SM = Ctx.getSourceManager();
-        auto &LO = Ctx.getLangOpts();
-
-        // Only pretty print JSON if debug is on
-        const char sep = Debug ? '\n' : ' ';
-
-        auto entryString = [](std::string k, std::string v) -> std::string {
-                return "    \"" + k + "\" : \"" + v + "\"";
-        };
-
-        auto entryInt = [](std::string k, int v) -> std::string {
-                return "    \"" + k + "\" : " + std::to_string(v);
-        };
-
-        auto entryBool = [](std::string k, bool v) -> std::string {
-                return "    \"" + k + "\" : " + (v ? "true" : "false");
-        };
-
-        bool emittedOneObject = false;
-
-        auto potentialLeadingComma = [&emittedOneObject](void) -> char {
-                return emittedOneObject ? ',' : ' ';
+// Records whether the subtree of the given Stmt, and of every Stmt under it
+// that has not been summarized yet, contains a jump statement.
+// Children are summarized before their parents, with an explicit stack since
+// the AST may be deep.
+static void summarizeJumps(
+        const clang::Stmt *Root,
+        llvm::DenseMap<const clang::Stmt *, bool> &SubtreeContainsJump) {
+        if (!Root || SubtreeContainsJump.count(Root))
+                return;
+
+        // Each Stmt is pushed once before its children are summarized, and
+        // once after
+        std::vector<std::pair<const clang::Stmt *, bool> > Stack = {
+                { Root, false }
         };
+        while (!Stack.empty()) {
+                auto Cur = Stack.back().first;
+                auto ChildrenDone = Stack.back().second;
+                Stack.pop_back();
+                if (!ChildrenDone) {
+                        if (SubtreeContainsJump.count(Cur))
+                                continue;
+                        Stack.push_back({ Cur, true });
+                        for (auto &&Child : Cur->children())
+                                if (Child && !SubtreeContainsJump.count(Child))
+                                        Stack.push_back({ Child, false });
+                        continue;
+                }
+                bool ContainsJump = isJump(Cur);
+                for (auto &&Child : Cur->children())
+                        if (Child)
+                                ContainsJump |=
+                                        SubtreeContainsJump.lookup(Child);
+                SubtreeContainsJump[Cur] = ContainsJump;
+        }
+}
 
-        llvm::outs() << "[\n";
-
-        // Print definition information
-        for (auto &&Entry : DC->MacroNamesDefinitions) {
-                std::string Name = Entry.first, DefLocOrError;
-                bool Valid;
-
-                auto MD = Entry.second;
-                auto DefLoc =
-                        MD ? SM.getFileLoc(MD->getDefinition().getLocation()) :
-                             clang::SourceLocation();
-                Valid = DefLoc.isValid();
-
-                // Try to get the full path to the DefLoc
-                auto Res = tryGetFullSourceLoc(SM, DefLoc);
-                Valid &= Res.first;
-                DefLocOrError = Res.second;
+// Only pretty print JSON if debug is on
+static const char sep = Debug ? '\n' : ' ';
 
-                auto MI = MD->getMacroInfo();
-                assert(MI);
+std::string entryString(std::string k, std::string v) {
+        return "    \"" + k + "\" : \"" + v + "\"";
+}
 
-                llvm::outs()
-                        << potentialLeadingComma() << "{" << sep
-                        << entryString("PropertiesOf", "Definition") << ','
-                        << sep << entryString("Name", Name) << ',' << sep
-                        << entryBool("IsObjectLike", MI->isObjectLike()) << ','
-                        << sep << entryBool("IsDefinitionLocationValid", Valid)
-                        << ',' << sep
-                        << entryString("DefinitionLocation", DefLocOrError)
-                        << sep << "}\n";
-                emittedOneObject = true;
-        }
+std::string entryBool(std::string k, bool v) {
+        return "    \"" + k + "\" : " + (v ? "true" : "false");
+}
 
-        // Collect declaration ranges
-        std::vector<const clang::Decl *> TopLevelDecls = ({
-                MatchFinder Finder;
-                DeclCollectorMatchHandler Handler;
-                auto Matcher =
-                        decl(unless(anyOf(isImplicit(), translationUnitDecl())))
-                                .bind("root");
-                Finder.addMatcher(Matcher, &Handler);
-                Finder.matchAST(Ctx);
-                Handler.Decls;
-        });
+// Collects all non-implicit declarations in the current traversal scope
+std::vector<const clang::Decl *> collectDecls(clang::ASTContext &Ctx) {
+        MatchFinder Finder;
+        DeclCollectorMatchHandler Handler;
+        auto Matcher = decl(unless(anyOf(isImplicit(), translationUnitDecl())))
+                               .bind("root");
+        Finder.addMatcher(Matcher, &Handler);
+        Finder.matchAST(Ctx);
+        return Handler.Decls;
+}
 
-        // Print names of macros inspected by the preprocessor
-        for (auto &&Name : DC->InspectedMacroNames) {
-                llvm::outs()
-                        << potentialLeadingComma() << "{" << sep
-                        << entryString("PropertiesOf", "InspectedByCPP") << ','
-                        << sep << entryString("Name", Name) << sep << "}\n";
-                emittedOneObject = true;
+// Fills in the sets that are derived from the other sets
+static void deriveASTNodeSets(ASTNodeSets &Sets) {
+        // Any reference to a decl declared at a local scope
+        // FIXME: Are there more types of decls we should be accounting for?
+        // Types, perhaps?
+        for (auto &&DRE : Sets.AllDeclRefExprs) {
+                auto D = DRE->getDecl();
+                if (auto VD = clang::dyn_cast<clang::VarDecl>(D))
+                        if (VD->hasLocalStorage())
+                                Sets.DeclRefExprsOfLocallyDefinedDecls.insert(
+                                        DRE);
         }
-        // Print include-directive information
-        {
-                std::set<llvm::StringRef> LocalIncludes;
-                for (auto &&IEL : IC->IncludeEntriesLocs) {
-                        // Facts for includes
-                        bool Valid = false;
-                        std::string IncludeName = "";
-
-                        // Check if included at global scope or not
-                        auto Res = isGlobalInclude(SM, LO, IEL, LocalIncludes,
-                                                   TopLevelDecls);
-                        if (!Res.first)
-                                LocalIncludes.insert(Res.second);
-
-                        Valid = Res.first;
-                        IncludeName = Res.second.empty() ? "" :
-                                                           Res.second.str();
 
-                        llvm::outs()
-                                << potentialLeadingComma() << "{" << sep
-                                << entryString("PropertiesOf", "Include") << ','
-                                << sep
-                                << entryBool("IsIncludeLocationValid", Valid)
-                                << ',' << sep
-                                << entryString("IncludeName", IncludeName)
-                                << sep << "}\n";
-                        emittedOneObject = true;
-                }
+        // Any expr that is the modified part of an expression with side-effects
+        for (auto &&E : Sets.SideEffectExprs) {
+                if (auto B = clang::dyn_cast<clang::BinaryOperator>(E))
+                        Sets.SideEffectExprsLHSs.insert(B->getLHS());
+                else if (auto U = clang::dyn_cast<clang::UnaryOperator>(E))
+                        Sets.SideEffectExprsLHSs.insert(U->getSubExpr());
         }
-        debug("Finished checking includes");
+}
 
-        // Collect certain sets of AST nodes that will be used for checking
-        // whether properties are satisfied
+// Collect certain sets of AST nodes in the current traversal scope that will
+// be used for checking whether properties are satisfied
+ASTNodeSets collectASTNodeSets(clang::ASTContext &Ctx) {
+        ASTNodeSets Sets;
 
         // Any reference to a decl
-        std::set<const clang::DeclRefExpr *> AllDeclRefExprs;
         {
                 MatchFinder Finder;
                 auto Matcher =
@@ -448,27 +534,12 @@ void Cpp2CASTConsumer::HandleTranslationUnit(clang::ASTContext &Ctx) {
                 Finder.addMatcher(Matcher, &Handler);
                 Finder.matchAST(Ctx);
                 for (auto &&ST : Handler.Stmts)
-                        AllDeclRefExprs.insert(
+                        Sets.AllDeclRefExprs.insert(
                                 clang::dyn_cast<clang::DeclRefExpr>(ST));
         }
 
-        // Any reference to a decl declared at a local scope
-        // FIXME: Are there more types of decls we should be accounting for?
-        // Types, perhaps?
-        std::set<const clang::DeclRefExpr *> DeclRefExprsOfLocallyDefinedDecls;
-        {
-                for (auto &&DRE : AllDeclRefExprs) {
-                        auto D = DRE->getDecl();
-                        if (auto VD = clang::dyn_cast<clang::VarDecl>(D))
-                                if (VD->hasLocalStorage())
-                                        DeclRefExprsOfLocallyDefinedDecls.insert(
-                                                DRE);
-                }
-        }
-
         // Any expr with side-effects
         // Binary assignment expressions, Pre/Post Inc/Dec
-        std::set<const clang::Expr *> SideEffectExprs;
         {
                 MatchFinder Finder;
                 auto Matcher =
@@ -483,24 +554,11 @@ void Cpp2CASTConsumer::HandleTranslationUnit(clang::ASTContext &Ctx) {
                 Finder.addMatcher(Matcher, &Handler);
                 Finder.matchAST(Ctx);
                 for (auto &&ST : Handler.Stmts)
-                        SideEffectExprs.insert(
+                        Sets.SideEffectExprs.insert(
                                 clang::dyn_cast<clang::Expr>(ST));
         }
 
-        // Any expr that is the modified part of an expression with side-effects
-        std::set<clang::Expr *> SideEffectExprsLHSs;
-        {
-                for (auto &&E : SideEffectExprs) {
-                        if (auto B = clang::dyn_cast<clang::BinaryOperator>(E))
-                                SideEffectExprsLHSs.insert(B->getLHS());
-                        else if (auto U = clang::dyn_cast<clang::UnaryOperator>(
-                                         E))
-                                SideEffectExprsLHSs.insert(U->getSubExpr());
-                }
-        }
-
         // Any expr that is an address-of expr
-        std::set<const clang::UnaryOperator *> AddressOfExprs;
         {
                 MatchFinder Finder;
                 auto Matcher =
@@ -513,13 +571,12 @@ void Cpp2CASTConsumer::HandleTranslationUnit(clang::ASTContext &Ctx) {
                 Finder.addMatcher(Matcher, &Handler);
                 Finder.matchAST(Ctx);
                 for (auto &&S : Handler.Stmts)
-                        AddressOfExprs.insert(
+                        Sets.AddressOfExprs.insert(
                                 clang::dyn_cast<clang::UnaryOperator>(S));
         }
 
         // Any expr that is the operand of an expression with short-circuiting.
         // ConditionalOperator, LogicalAnd, LogicalOr
-        std::set<const clang::Expr *> ConditionalExprs;
         {
                 MatchFinder Finder;
                 auto Matcher =
@@ -535,11 +592,10 @@ void Cpp2CASTConsumer::HandleTranslationUnit(clang::ASTContext &Ctx) {
                 Finder.matchAST(Ctx);
                 for (auto &&ST : Handler.Stmts)
                         if (auto E = clang::dyn_cast<clang::Expr>(ST))
-                                ConditionalExprs.insert(E);
+                                Sets.ConditionalExprs.insert(E);
         }
 
         // Any expr with a type defined at a local scope
-        std::set<const clang::Expr *> ExprsWithLocallyDefinedTypes;
         {
                 MatchFinder Finder;
                 auto Matcher = expr(unless(anyOf(implicitCastExpr(),
@@ -552,145 +608,916 @@ void Cpp2CASTConsumer::HandleTranslationUnit(clang::ASTContext &Ctx) {
                         auto E = clang::dyn_cast<clang::Expr>(ST);
                         auto QT = E->getType();
                         if (hasLocalType(QT.getTypePtrOrNull(), Ctx))
-                                ExprsWithLocallyDefinedTypes.insert(E);
+                                Sets.ExprsWithLocallyDefinedTypes.insert(E);
                 }
         }
 
-        // Print macro expansion information
-        for (auto Exp : MF->Expansions) {
-                assert(Exp);
-                assert(Exp->MI);
+        deriveASTNodeSets(Sets);
+        return Sets;
+}
+
+// Collects the same sets as collectASTNodeSets, but with a single traversal
+// that skips the subtrees that contain no expanded tokens.
+// The properties only look at nodes expanded from macros and at the nodes
+// enclosing them, none of which are skipped.
+class ASTNodeSetCollector {
+    private:
+        clang::ASTContext &Ctx;
+        ASTNodeSets &Sets;
+
+    public:
+        ASTNodeSetCollector(clang::ASTContext &Ctx, ASTNodeSets &Sets)
+                : Ctx(Ctx), Sets(Sets) {
+        }
+
+        void operator()(const clang::Stmt &ST) {
+                if (llvm::isa<clang::ImplicitCastExpr>(ST) ||
+                    llvm::isa<clang::ImplicitValueInitExpr>(ST))
+                        return;
+                auto E = clang::dyn_cast<clang::Expr>(&ST);
+                if (!E)
+                        return;
+
+                if (auto DRE = clang::dyn_cast<clang::DeclRefExpr>(E))
+                        Sets.AllDeclRefExprs.insert(DRE);
+
+                if (auto B = clang::dyn_cast<clang::BinaryOperator>(E)) {
+                        if (B->isAssignmentOp())
+                                Sets.SideEffectExprs.insert(E);
+                        if (B->getOpcode() == clang::BO_LAnd ||
+                            B->getOpcode() == clang::BO_LOr)
+                                Sets.ConditionalExprs.insert(E);
+                } else if (auto U = clang::dyn_cast<clang::UnaryOperator>(E)) {
+                        if (U->isIncrementDecrementOp())
+                                Sets.SideEffectExprs.insert(E);
+                        if (U->getOpcode() == clang::UO_AddrOf)
+                                Sets.AddressOfExprs.insert(U);
+                } else if (llvm::isa<clang::ConditionalOperator>(E))
+                        Sets.ConditionalExprs.insert(E);
+
+                if (hasLocalType(E->getType().getTypePtrOrNull(), Ctx))
+                        Sets.ExprsWithLocallyDefinedTypes.insert(E);
+        }
+
+        void operator()(const clang::Decl &D) {
+        }
+
+        void operator()(clang::TypeLoc TL) {
+        }
+};
+
+ASTNodeSets collectASTNodeSets(clang::ASTContext &Ctx,
+                               const cpp2c::MacroRegions &Regions) {
+        ASTNodeSets Sets;
+        ASTNodeSetCollector Collector(Ctx, Sets);
+        traversePruned(Ctx, Regions, Collector);
+        deriveASTNodeSets(Sets);
+        return Sets;
+}
+
+Cpp2CASTConsumer::Cpp2CASTConsumer(clang::CompilerInstance &CI,
+                                   const cpp2c::Cpp2COptions &Opts,
+                                   llvm::raw_ostream *Out)
+        : Opts(Opts), Filter(CI.getSourceManager(), Opts),
+          Alignment(CI.getASTContext()),
+          TypeStringsSaver(TypeStringsAllocator) {
+        clang::Preprocessor &PP = CI.getPreprocessor();
+        clang::ASTContext &Ctx = CI.getASTContext();
+
+        // Write results to the given output file if there is one, and to
+        // stdout otherwise
+        if (Out)
+                OS = Out;
+        else if (Opts.OutputFile.empty())
+                OS = &llvm::outs();
+        else if (auto EC = OutputFile.open(Opts.OutputFile)) {
+                auto &Diags = CI.getDiagnostics();
+                auto ID = Diags.getCustomDiagID(
+                        clang::DiagnosticsEngine::Error,
+                        "cannot open output file '%0': %1");
+                Diags.Report(ID) << Opts.OutputFile << EC.message();
+        } else
+                OS = &OutputFile.os();
+
+        if (OS) {
+                *OS << "[\n";
+                Writer = std::make_unique<cpp2c::RecordWriter>(*OS);
+        }
 
-                // String properties
-                std::string Name, DefinitionLocation, EndDefinitionLocation,
-                        InvocationLocation, ASTKind, TypeSignature;
-
-                // Integer properties
-                int InvocationDepth;
-                int NumASTRoots;
-                int NumArguments;
-
-                // Boolean properties
-                bool HasStringification = false;
-                bool HasTokenPasting = false;
-                bool HasAlignedArguments = false;
-                bool HasSameNameAsOtherDeclaration = false;
-                bool IsExpansionControlFlowStmt = false;
-                bool DoesBodyReferenceMacroDefinedAfterMacro = false;
-                bool DoesBodyReferenceDeclDeclaredAfterMacro = false;
-                bool DoesBodyContainDeclRefExpr = false;
-                bool DoesSubexpressionExpandedFromBodyHaveLocalType = false;
-                bool DoesSubexpressionExpandedFromBodyHaveTypeDefinedAfterMacro = false;
-                bool DoesAnyArgumentHaveSideEffects = false;
-                bool DoesAnyArgumentContainDeclRefExpr = false;
-                bool IsHygienic = false;
-                bool IsDefinitionLocationValid = false;
-                bool IsInvocationLocationValid = false;
-                bool IsObjectLike = false;
-                bool IsInvokedInMacroArgument = false;
-                bool IsNamePresentInCPPConditional = false;
-                bool IsExpansionICE = false;
-                bool IsExpansionTypeNull = false;
-                bool IsExpansionTypeAnonymous = false;
-                bool IsExpansionTypeLocalType = false;
-                bool IsExpansionTypeDefinedAfterMacro = false;
-                bool IsExpansionTypeVoid = false;
-                bool IsAnyArgumentTypeNull = false;
-                bool IsAnyArgumentTypeAnonymous = false;
-                bool IsAnyArgumentTypeLocalType = false;
-                bool IsAnyArgumentTypeDefinedAfterMacro = false;
-                bool IsAnyArgumentTypeVoid = false;
-                bool IsInvokedWhereModifiableValueRequired = false;
-                bool IsInvokedWhereAddressableValueRequired = false;
-                bool IsInvokedWhereICERequired = false;
-                bool IsAnyArgumentExpandedWhereModifiableValueRequired = false;
-                bool IsAnyArgumentExpandedWhereAddressableValueRequired = false;
-                bool IsAnyArgumentConditionallyEvaluated = false;
-                bool IsAnyArgumentNeverExpanded = false;
-                bool IsAnyArgumentNotAnExpression = false;
-
-                Name = Exp->Name.str();
-                InvocationDepth = Exp->Depth;
-                NumArguments = Exp->Arguments.size();
-                HasStringification = Exp->HasStringification;
-                HasTokenPasting = Exp->HasTokenPasting;
-
-                HasSameNameAsOtherDeclaration =
-                        // First check if any macro defined before this macro
-                        // has the same name as any of this macro's parameters
-                        std::any_of(
-                                DC->MacroNamesDefinitions.begin(),
-                                DC->MacroNamesDefinitions.end(),
-                                [&SM,
-                                 &Exp](std::pair<std::string,
-                                                 const clang::MacroDirective *>
-                                               Entry) {
-                                        return SM.isBeforeInTranslationUnit(
-                                                       SM.getFileLoc(
-                                                               Entry.second
-                                                                       ->getDefinition()
-                                                                       .getLocation()),
-                                                       SM.getFileLoc(
-                                                               Exp->MI->getDefinitionLoc())) &&
-                                               std::any_of(
-                                                       Exp->Arguments.begin(),
-                                                       Exp->Arguments.end(),
-                                                       [&Entry](
-                                                               MacroExpansionArgument
-                                                                       Arg) {
-                                                               return Arg.Name.str() ==
-                                                                      Entry.first;
-                                                       });
-                                }) ||
-                        // Also check if any global declarations defined before
-                        // this macro have the same name as this macro
-                        std::any_of(
-                                TopLevelDecls.begin(), TopLevelDecls.end(),
-                                [&SM, &Exp](const clang::Decl *D) {
-                                        auto ND = clang::dyn_cast_or_null<
-                                                clang::NamedDecl>(D);
-                                        if (!ND)
-                                                return false;
-                                        auto II = ND->getIdentifier();
-                                        if (!II)
-                                                return false;
-                                        return II->getName().str() ==
-                                                       Exp->Name.str() &&
-                                               SM.isBeforeInTranslationUnit(
-                                                       SM.getFileLoc(
-                                                               D->getBeginLoc()),
-                                                       SM.getFileLoc(
-                                                               Exp->MI->getDefinitionLoc()));
-                                });
-                IsObjectLike = Exp->MI->isObjectLike();
-                IsInvokedInMacroArgument = Exp->InMacroArg;
-                IsNamePresentInCPPConditional =
-                        DC->InspectedMacroNames.find(Exp->Name.str()) !=
-                        DC->InspectedMacroNames.end();
-
-                // Definition location
-                auto Res = tryGetFullSourceLoc(SM, Exp->MI->getDefinitionLoc());
-                IsDefinitionLocationValid = Res.first;
-                if (IsDefinitionLocationValid)
-                        DefinitionLocation = Res.second;
-                auto [IsEndDefinitonLocationValid, EndLoc] =
-                        tryGetFullSourceLoc(SM, Exp->MI->getDefinitionEndLoc());
-                if (IsEndDefinitonLocationValid)
-                        EndDefinitionLocation = EndLoc;
-
-                // Invocation location
-                Res = tryGetFullSourceLoc(SM, Exp->SpellingRange.getBegin());
-                IsInvocationLocationValid = Res.first;
-                if (IsInvocationLocationValid)
-                        InvocationLocation = Res.second;
-
-                auto DefLoc = SM.getFileLoc(Exp->MI->getDefinitionLoc());
-
-                // Check if any macro this macro invokes were defined after
-                // this macro was
+        Timer.start(!Opts.StatsFile.empty());
+
+        if (Opts.AnalysisEngine == Engine::Fast) {
+                Alignment.Index = &Index;
+                Alignment.Locations.setEnabled(true);
+                Alignment.Regions = &Regions;
+        }
+
+        if (Opts.Jobs != 1)
+                Pool = std::make_unique<llvm::ThreadPool>(
+                        llvm::hardware_concurrency(Opts.Jobs));
+
+        MF = new cpp2c::MacroForest(PP, Ctx,
+                                    Filter.empty() ? nullptr : &Filter);
+        IC = new cpp2c::IncludeCollector();
+        DC = new cpp2c::DefinitionInfoCollector(Ctx);
+
+        PP.addPPCallbacks(std::unique_ptr<cpp2c::MacroForest>(MF));
+        PP.addPPCallbacks(std::unique_ptr<cpp2c::IncludeCollector>(IC));
+        PP.addPPCallbacks(std::unique_ptr<cpp2c::DefinitionInfoCollector>(DC));
+}
+
+char Cpp2CASTConsumer::potentialLeadingComma() {
+        return EmittedOneObject ? ',' : ' ';
+}
+
+void Cpp2CASTConsumer::emitPreprocessorInfo(
+        clang::ASTContext &Ctx,
+        std::vector<const clang::Decl *> &TopLevelDecls) {
+        auto &SM = Ctx.getSourceManager();
+        auto &LO = Ctx.getLangOpts();
+        auto &Out = *OS;
+
+        Timer.enter(PhaseTimer::Emit);
+        // Write the invocations emitted so far before writing to the stream
+        // ourselves
+        Writer->drain();
+
+        // Print definition information.
+        // Definitions in files we do not analyze are still collected, since
+        // other macros are checked against their names, but not printed.
+        for (auto &&Entry : DC->MacroNamesDefinitions) {
+                if (Entry.second &&
+                    !Filter.shouldAnalyze(Entry.second->getLocation()))
+                        continue;
+
+                std::string Name = Entry.first->getName().str(), DefLocOrError;
+                bool Valid;
+
+                auto MD = Entry.second;
+                auto DefLoc =
+                        MD ? SM.getFileLoc(MD->getDefinition().getLocation()) :
+                             clang::SourceLocation();
+                Valid = DefLoc.isValid();
+
+                // Try to get the full path to the DefLoc
+                auto Res = tryGetFullSourceLoc(SM, DefLoc);
+                Valid &= Res.first;
+                DefLocOrError = Res.second;
+
+                auto MI = MD->getMacroInfo();
+                assert(MI);
+
+                Out << potentialLeadingComma() << "{" << sep
+                    << entryString("PropertiesOf", "Definition") << ',' << sep
+                    << entryString("Name", Name) << ',' << sep
+                    << entryBool("IsObjectLike", MI->isObjectLike()) << ','
+                    << sep << entryBool("IsDefinitionLocationValid", Valid)
+                    << ',' << sep
+                    << entryString("DefinitionLocation", DefLocOrError) << sep
+                    << "}\n";
+                EmittedOneObject = true;
+        }
+
+        // Print names of macros inspected by the preprocessor
+        for (auto &&Name : DC->inspectedMacroNames()) {
+                Out << potentialLeadingComma() << "{" << sep
+                    << entryString("PropertiesOf", "InspectedByCPP") << ','
+                    << sep << entryString("Name", Name.str()) << sep << "}\n";
+                EmittedOneObject = true;
+        }
+        // Print include-directive information
+        {
+                std::set<llvm::StringRef> LocalIncludes;
+                for (auto &&IEL : IC->IncludeEntriesLocs) {
+                        // Facts for includes
+                        bool Valid = false;
+                        std::string IncludeName = "";
+
+                        // Check if included at global scope or not
+                        auto Res = isGlobalInclude(SM, LO, IEL, LocalIncludes,
+                                                   TopLevelDecls);
+                        if (!Res.first)
+                                LocalIncludes.insert(Res.second);
+
+                        // Includes in files we do not analyze still
+                        // decide whether later includes are local
+                        if (!Filter.shouldAnalyze(IEL.second))
+                                continue;
+
+                        Valid = Res.first;
+                        IncludeName = Res.second.empty() ? "" :
+                                                           Res.second.str();
+
+                        Out << potentialLeadingComma() << "{" << sep
+                            << entryString("PropertiesOf", "Include") << ','
+                            << sep
+                            << entryBool("IsIncludeLocationValid", Valid)
+                            << ',' << sep
+                            << entryString("IncludeName", IncludeName) << sep
+                            << "}\n";
+                        EmittedOneObject = true;
+                }
+        }
+        debug("Finished checking includes");
+}
+
+// Numbers the Stmts under the Stmts aligned with the given expansions and
+// their arguments, and labels them with the sets they are in.
+// The index must be finished before it is queried.
+static void indexSubtrees(
+        const std::vector<cpp2c::MacroExpansionNode *> &Expansions,
+        ASTNodeSets &Sets) {
+        auto &Subtrees = Sets.Subtrees;
+        // Number bodies first, since arguments are usually under them
+        for (auto &&Exp : Expansions)
+                if (Exp->AlignedRoot)
+                        Subtrees.addRoot(Exp->AlignedRoot->ST);
+        for (auto &&Exp : Expansions)
+                for (auto &&Arg : Exp->Arguments)
+                        for (auto &&Root : Arg.AlignedRoots)
+                                Subtrees.addRoot(Root.ST);
+
+        for (auto &&DRE : Sets.AllDeclRefExprs)
+                Subtrees.addLabel(DeclRefLabel, DRE);
+        for (auto &&DRE : Sets.DeclRefExprsOfLocallyDefinedDecls)
+                Subtrees.addLabel(LocalDeclRefLabel, DRE);
+        for (auto &&E : Sets.SideEffectExprs) {
+                Subtrees.addLabel(SideEffectLabel, E);
+                clang::Expr *LHS = nullptr;
+                if (auto B = clang::dyn_cast<clang::BinaryOperator>(E))
+                        LHS = B->getLHS();
+                else if (auto U = clang::dyn_cast<clang::UnaryOperator>(E))
+                        LHS = U->getSubExpr();
+                Subtrees.addLabel(ModifiedOperandLabel,
+                                  skipImplicitAndParens(LHS));
+        }
+        for (auto &&U : Sets.AddressOfExprs) {
+                Subtrees.addLabel(AddressOfLabel, U);
+                Subtrees.addLabel(AddressedOperandLabel,
+                                  skipImplicitAndParens(U->getSubExpr()));
+        }
+        for (auto &&E : Sets.ExprsWithLocallyDefinedTypes)
+                Subtrees.addLabel(LocalTypeLabel, E);
+}
+
+// Ranks the file locations of the decls that the indexed DeclRefExprs refer
+// to in translation unit order, and stores them in the given vector in that
+// order.
+// Must be called after indexing subtrees, but before finishing the index,
+// since it labels the DeclRefExprs that cannot be ranked.
+static void
+rankReferencedDecls(clang::SourceManager &SM, ASTNodeSets &Sets,
+                    std::vector<clang::SourceLocation> &OrderedDeclLocs) {
+        auto &Subtrees = Sets.Subtrees;
+        std::vector<std::pair<unsigned, clang::SourceLocation> > Refs;
+        llvm::DenseMap<clang::SourceLocation::UIntTy, unsigned> Ranks;
+        OrderedDeclLocs.clear();
+        for (auto &&DRE : Sets.AllDeclRefExprs) {
+                cpp2c::SubtreeIndex::Interval I;
+                if (!Subtrees.intervalOf(DRE, I))
+                        continue;
+                auto L = SM.getFileLoc(DRE->getDecl()->getLocation());
+                if (L.isInvalid()) {
+                        Subtrees.addLabel(UnrankedDeclRefLabel, DRE);
+                        continue;
+                }
+                Refs.push_back({ I.first, L });
+                if (Ranks.insert({ L.getRawEncoding(), 0 }).second)
+                        OrderedDeclLocs.push_back(L);
+        }
+
+        // Distinct file locations are totally ordered, so they can be sorted
+        // with the same comparison the property uses
+        std::sort(OrderedDeclLocs.begin(), OrderedDeclLocs.end(),
+                  [&SM](clang::SourceLocation L, clang::SourceLocation R) {
+                          return SM.isBeforeInTranslationUnit(L, R);
+                  });
+        for (unsigned Rank = 0; Rank < OrderedDeclLocs.size(); Rank++)
+                Ranks[OrderedDeclLocs[Rank].getRawEncoding()] = Rank;
+
+        std::vector<unsigned> Values(Subtrees.size());
+        for (auto &&Ref : Refs)
+                Values[Ref.first] = Ranks[Ref.second.getRawEncoding()] + 1;
+        Sets.DeclRanks.build(std::move(Values));
+        Sets.RankedDecls = true;
+}
+
+// The Stmts expanded from an expansion, as disjoint intervals of numbers in
+// a SubtreeIndex
+struct ExpandedIntervals {
+        // The Stmts expanded from the arguments
+        std::vector<cpp2c::SubtreeIndex::Interval> Arguments;
+        // The Stmts expanded from the body but not from the arguments
+        std::vector<cpp2c::SubtreeIndex::Interval> BodyOnly;
+
+        // Returns the number of Stmts with the given label in the given
+        // intervals
+        static unsigned
+        count(const cpp2c::SubtreeIndex &Subtrees, unsigned Label,
+              const std::vector<cpp2c::SubtreeIndex::Interval> &Intervals) {
+                unsigned N = 0;
+                for (auto &&I : Intervals)
+                        N += Subtrees.count(Label, I);
+                return N;
+        }
+};
+
+// Finds the intervals of the Stmts expanded from the given expansion, if all
+// of its aligned Stmts were numbered together.
+// The body is only considered if Body is not null.
+static bool findExpandedIntervals(cpp2c::MacroExpansionNode *Exp,
+                                  const clang::Stmt *Body,
+                                  const cpp2c::SubtreeIndex &Subtrees,
+                                  ExpandedIntervals &Out) {
+        using Interval = cpp2c::SubtreeIndex::Interval;
+        Out.Arguments.clear();
+        Out.BodyOnly.clear();
+
+        // The intervals of any two numbered subtrees are either nested or
+        // disjoint, so sorting them and dropping the nested ones leaves the
+        // union of the argument subtrees as disjoint intervals
+        std::vector<Interval> Roots;
+        for (auto &&Arg : Exp->Arguments)
+                for (auto &&Root : Arg.AlignedRoots) {
+                        if (!Root.ST)
+                                continue;
+                        Interval I;
+                        if (!Subtrees.intervalOf(Root.ST, I))
+                                return false;
+                        Roots.push_back(I);
+                }
+        std::sort(Roots.begin(), Roots.end());
+        for (auto &&I : Roots)
+                if (Out.Arguments.empty() ||
+                    Out.Arguments.back().second <= I.first)
+                        Out.Arguments.push_back(I);
+
+        if (!Body)
+                return true;
+        Interval B;
+        if (!Subtrees.intervalOf(Body, B))
+                return false;
+        // Cut the argument subtrees out of the body's
+        auto Next = B.first;
+        for (auto &&I : Out.Arguments) {
+                if (I.second <= B.first || B.second <= I.first)
+                        continue;
+                if (Next < I.first)
+                        Out.BodyOnly.push_back({ Next, I.first });
+                Next = std::max(Next, I.second);
+        }
+        if (Next < B.second)
+                Out.BodyOnly.push_back({ Next, B.second });
+        return true;
+}
+
+// Returns true if any of the given conditional expressions was expanded from
+// the body of an expansion and contains a Stmt expanded from its arguments
+static bool anyConditionalContainsArgument(
+        const std::set<const clang::Expr *> &ConditionalExprs,
+        const std::set<const clang::Stmt *> &StmtsExpandedFromBody,
+        const std::set<const clang::Stmt *> &StmtsExpandedFromArguments) {
+        return std::any_of(
+                ConditionalExprs.begin(), ConditionalExprs.end(),
+                [&](const clang::Expr *CE) {
+                        return StmtsExpandedFromBody.find(CE) !=
+                                       StmtsExpandedFromBody.end() &&
+                               std::any_of(StmtsExpandedFromArguments.begin(),
+                                           StmtsExpandedFromArguments.end(),
+                                           [&CE](const clang::Stmt *ArgStmt) {
+                                                   return inTree(ArgStmt, CE);
+                                           });
+                });
+}
+
+// Returns true if any ancestor of the given aligned root of an argument, up
+// to the aligned root of the expansion's body, is one of the given
+// conditional expressions and was expanded from the body.
+// A conditional expression expanded from the body contains a Stmt expanded
+// from an argument if and only if it is such an ancestor of the argument's
+// aligned root, so checking every aligned root this way is equivalent to
+// anyConditionalContainsArgument, but only takes as many steps as the
+// roots are deep in the body.
+static bool hasConditionalAncestorInBody(
+        const clang::Stmt *ArgRoot,
+        const llvm::DenseMap<const clang::Stmt *, const clang::Stmt *>
+                &BodyParents,
+        const std::set<const clang::Stmt *> &StmtsExpandedFromBody,
+        const std::set<const clang::Expr *> &ConditionalExprs) {
+        auto It = BodyParents.find(ArgRoot);
+        if (It == BodyParents.end())
+                return false;
+        for (auto Cur = It->second; Cur; Cur = BodyParents.lookup(Cur)) {
+                auto E = clang::dyn_cast<clang::Expr>(Cur);
+                if (E && ConditionalExprs.count(E) &&
+                    StmtsExpandedFromBody.count(E))
+                        return true;
+        }
+        return false;
+}
+
+// Scratch space for analyzing expansions.
+// Each task that analyzes a chunk of expansions uses its own, and reuses it
+// for every expansion in the chunk.
+struct PropertyScratch {
+        std::set<const clang::Stmt *> StmtsExpandedFromArguments;
+        std::set<const clang::Stmt *> StmtsExpandedFromBody;
+        // The parent of each Stmt in the subtree of the body's aligned root,
+        // if the fast engine is used
+        llvm::DenseMap<const clang::Stmt *, const clang::Stmt *> BodyParents;
+        // The Stmts expanded from the expansion, if its aligned Stmts were
+        // indexed
+        ExpandedIntervals Intervals;
+};
+
+// The results of analyzing the AST nodes aligned with an expansion
+struct ExpansionAnalysis {
+        cpp2c::InvocationRecord Record;
+        // Whether the properties of the expansion's body were analyzed,
+        // i.e., whether the body aligned with a Stmt and every argument
+        // aligned with as many nodes as it was expanded
+        bool AnalyzedBody = false;
+        // The nodes expanded from the body whose properties depend on the
+        // source manager, and so are checked after the parallel phase
+        std::vector<const clang::DeclRefExpr *> BodyDeclRefExprs;
+        std::vector<const clang::DeclRefExpr *> BodyLocalDeclRefExprs;
+        std::set<const clang::Decl *> BodyTypeDecls;
+        // If RankedBodyDecls is set, one more than the greatest rank of the
+        // decls referred to from the body, or 0 if there are none
+        unsigned LatestBodyDeclRank = 0;
+        bool RankedBodyDecls = false;
+};
+
+// Analyzes the AST nodes aligned with the given top-level expansion.
+// This only reads the AST and the given sets, and does not use the source
+// manager, so it may run for many expansions at once.
+static void analyzeAlignedNodes(cpp2c::MacroExpansionNode *Exp,
+                                clang::ASTContext &Ctx,
+                                const ASTNodeSets &Sets,
+                                cpp2c::Engine AnalysisEngine,
+                                PropertyScratch &Scratch,
+                                ExpansionAnalysis &A) {
+        auto &R = A.Record;
+        auto &AllDeclRefExprs = Sets.AllDeclRefExprs;
+        auto &DeclRefExprsOfLocallyDefinedDecls =
+                Sets.DeclRefExprsOfLocallyDefinedDecls;
+        auto &SideEffectExprs = Sets.SideEffectExprs;
+        auto &AddressOfExprs = Sets.AddressOfExprs;
+        auto &ConditionalExprs = Sets.ConditionalExprs;
+        auto &ExprsWithLocallyDefinedTypes = Sets.ExprsWithLocallyDefinedTypes;
+        auto &StmtsExpandedFromArguments = Scratch.StmtsExpandedFromArguments;
+        auto &StmtsExpandedFromBody = Scratch.StmtsExpandedFromBody;
+        auto &BodyParents = Scratch.BodyParents;
+        StmtsExpandedFromArguments.clear();
+        StmtsExpandedFromBody.clear();
+        BodyParents.clear();
+
+        // Number of AST roots
+        R.NumASTRoots = Exp->ASTRoots.size();
+
+        // Determine the AST kind of the expansion
+        debug("Checking if expansion has aligned root");
+        if (Exp->AlignedRoot) {
+                auto D = Exp->AlignedRoot->D;
+                auto ST = Exp->AlignedRoot->ST;
+                auto TL = Exp->AlignedRoot->TL;
+
+                if (ST) {
+                        debug("Aligns with a stmt");
+                        R.ASTKind = "Stmt";
+                } else if (D) {
+                        debug("Aligns with a decl");
+                        R.ASTKind = "Decl";
+                } else if (TL) {
+                        debug("Aligns with a type loc");
+                        R.ASTKind = "TypeLoc";
+                        R.IsExpansionTypeNull = TL->isNull();
+
+                        // FIXME: We would also like to check that this type
+                        // specifier list does not include a typedef that was
+                        // defined after the macro was defined, but calling
+                        // hasTypeDefinedAfter on TL->getTypePtr() sometimes
+                        // triggers an error inside Clang. Until this is
+                        // fixed, we will not be able to gather full data on
+                        // TypeLocs.
+                } else
+                        assert("Aligns with node that is not a Decl/Stmt/TypeLoc");
+        }
+
+        // Check that the number of AST nodes aligned with each
+        // argument equals the number of times that argument was
+        // expanded
+        debug("Checking if arguments are all aligned");
+        R.HasAlignedArguments = std::all_of(
+                Exp->Arguments.begin(), Exp->Arguments.end(),
+                [](const MacroExpansionArgument &Arg) {
+                        return Arg.AlignedRoots.size() == Arg.NumExpansions;
+                });
+        debug("Done checking if arguments are all aligned");
+
+        auto ExpandedFromArgument =
+                [&StmtsExpandedFromArguments](const clang::Stmt *St) {
+                        return StmtsExpandedFromArguments.find(St) !=
+                               StmtsExpandedFromArguments.end();
+                };
+        auto ExpandedFromBody =
+                [&StmtsExpandedFromBody](const clang::Stmt *St) {
+                        return StmtsExpandedFromBody.find(St) !=
+                               StmtsExpandedFromBody.end();
+                };
+
+        // If the Stmts aligned with this expansion were indexed, count the
+        // Stmts in the sets that were expanded from it instead of scanning
+        // the sets
+        const clang::Stmt *Body =
+                Exp->AlignedRoot ? Exp->AlignedRoot->ST : nullptr;
+        auto &Intervals = Scratch.Intervals;
+        bool Indexed = Sets.IndexedSubtrees &&
+                       findExpandedIntervals(Exp, Body, Sets.Subtrees,
+                                             Intervals);
+        auto CountInArguments = [&Sets, &Intervals](unsigned Label) {
+                return ExpandedIntervals::count(Sets.Subtrees, Label,
+                                                Intervals.Arguments);
+        };
+        auto CountInBodyOnly = [&Sets, &Intervals](unsigned Label) {
+                return ExpandedIntervals::count(Sets.Subtrees, Label,
+                                                Intervals.BodyOnly);
+        };
+
+        // Semantic properties of the macro's arguments
+        if (R.HasAlignedArguments) {
+                debug("Collecting argument subtrees");
+                for (auto &&Arg : Exp->Arguments)
+                        for (auto &&Root : Arg.AlignedRoots)
+                                insertSubtrees(Root.ST,
+                                               StmtsExpandedFromArguments);
+                debug("Done collecting argument subtrees");
+        }
+
+        if (R.HasAlignedArguments && Indexed) {
+                R.DoesAnyArgumentHaveSideEffects =
+                        CountInArguments(SideEffectLabel) > 0;
+                R.DoesAnyArgumentContainDeclRefExpr =
+                        CountInArguments(DeclRefLabel) > 0;
+                // Each operand belongs to exactly one expression, and an
+                // expression expanded from an argument has its operand
+                // expanded from it too, so the operands expanded from
+                // arguments whose expressions were not are the difference
+                R.IsAnyArgumentExpandedWhereModifiableValueRequired =
+                        CountInArguments(ModifiedOperandLabel) >
+                        CountInArguments(SideEffectLabel);
+                R.IsAnyArgumentExpandedWhereAddressableValueRequired =
+                        CountInArguments(AddressedOperandLabel) >
+                        CountInArguments(AddressOfLabel);
+        } else if (R.HasAlignedArguments) {
+                R.DoesAnyArgumentHaveSideEffects =
+                        std::any_of(SideEffectExprs.begin(),
+                                    SideEffectExprs.end(),
+                                    ExpandedFromArgument);
+
+                R.DoesAnyArgumentContainDeclRefExpr =
+                        std::any_of(AllDeclRefExprs.begin(),
+                                    AllDeclRefExprs.end(),
+                                    ExpandedFromArgument);
+
+                R.IsAnyArgumentExpandedWhereModifiableValueRequired = std::any_of(
+                        SideEffectExprs.begin(), SideEffectExprs.end(),
+                        [&ExpandedFromArgument](const clang::Expr *E) {
+                                // Only consider side-effect expressions which
+                                // were not expanded from an argument of the
+                                // same macro
+                                if (!ExpandedFromArgument(E)) {
+                                        clang::Expr *LHS = nullptr;
+                                        auto B = clang::dyn_cast<
+                                                clang::BinaryOperator>(E);
+                                        auto U = clang::dyn_cast<
+                                                clang::UnaryOperator>(E);
+                                        if (B)
+                                                LHS = B->getLHS();
+                                        else if (U)
+                                                LHS = U->getSubExpr();
+                                        LHS = skipImplicitAndParens(LHS);
+                                        return ExpandedFromArgument(LHS);
+                                }
+                                return false;
+                        });
+
+                R.IsAnyArgumentExpandedWhereAddressableValueRequired = std::any_of(
+                        AddressOfExprs.begin(), AddressOfExprs.end(),
+                        [&ExpandedFromArgument](const clang::UnaryOperator *U) {
+                                // Only consider address of expressions which
+                                // were not expanded from an argument of the
+                                // same macro
+                                if (!ExpandedFromArgument(U)) {
+                                        auto Operand = U->getSubExpr();
+                                        Operand =
+                                                skipImplicitAndParens(Operand);
+                                        return ExpandedFromArgument(Operand);
+                                }
+                                return false;
+                        });
+        }
+
+        // Semantic properties of the macro body
+        if (Exp->AlignedRoot && Exp->AlignedRoot->ST && R.HasAlignedArguments) {
+                auto ST = Exp->AlignedRoot->ST;
+                A.AnalyzedBody = true;
+                if (llvm::isa<clang::Expr>(ST))
+                        R.ASTKind = "Expr";
+
+                debug("Collecting body subtrees");
+                if (AnalysisEngine == Engine::Fast)
+                        insertSubtrees(ST, StmtsExpandedFromBody,
+                                       BodyParents);
+                else
+                        insertSubtrees(ST, StmtsExpandedFromBody);
+                // Remove all Stmts which were actually expanded from arguments
+                for (auto &&St : StmtsExpandedFromArguments)
+                        StmtsExpandedFromBody.erase(St);
+
+                debug("Checking if any argument is conditionally "
+                      "evaluated in the body of the expansion");
+                if (AnalysisEngine == Engine::Fast) {
+                        R.IsAnyArgumentConditionallyEvaluated = false;
+                        for (auto &&Arg : Exp->Arguments)
+                                for (auto &&Root : Arg.AlignedRoots)
+                                        R.IsAnyArgumentConditionallyEvaluated |=
+                                                hasConditionalAncestorInBody(
+                                                        Root.ST, BodyParents,
+                                                        StmtsExpandedFromBody,
+                                                        ConditionalExprs);
+                } else
+                        R.IsAnyArgumentConditionallyEvaluated =
+                                anyConditionalContainsArgument(
+                                        ConditionalExprs,
+                                        StmtsExpandedFromBody,
+                                        StmtsExpandedFromArguments);
+                debug("Done checking if any argument is conditionally "
+                      "evaluated in the body of the expansion");
+
+                if (Indexed) {
+                        auto &Subtrees = Sets.Subtrees;
+                        for (auto &&I : Intervals.BodyOnly)
+                                for (auto N = I.first; N < I.second; N++) {
+                                        auto DRE = clang::dyn_cast<
+                                                clang::DeclRefExpr>(
+                                                Subtrees.node(N));
+                                        if (Subtrees.has(DeclRefLabel, N))
+                                                A.BodyDeclRefExprs.push_back(
+                                                        DRE);
+                                        if (Subtrees.has(LocalDeclRefLabel, N))
+                                                A.BodyLocalDeclRefExprs
+                                                        .push_back(DRE);
+                                }
+                        R.DoesSubexpressionExpandedFromBodyHaveLocalType =
+                                CountInBodyOnly(LocalTypeLabel) > 0;
+                        if (Sets.RankedDecls &&
+                            CountInBodyOnly(UnrankedDeclRefLabel) == 0) {
+                                for (auto &&I : Intervals.BodyOnly)
+                                        A.LatestBodyDeclRank = std::max(
+                                                A.LatestBodyDeclRank,
+                                                Sets.DeclRanks.max(I));
+                                A.RankedBodyDecls = true;
+                        }
+                } else {
+                        for (auto &&DRE : AllDeclRefExprs)
+                                if (ExpandedFromBody(DRE))
+                                        A.BodyDeclRefExprs.push_back(DRE);
+                        for (auto &&DRE : DeclRefExprsOfLocallyDefinedDecls)
+                                if (ExpandedFromBody(DRE))
+                                        A.BodyLocalDeclRefExprs.push_back(
+                                                DRE);
+                        R.DoesSubexpressionExpandedFromBodyHaveLocalType =
+                                std::any_of(
+                                        ExprsWithLocallyDefinedTypes.begin(),
+                                        ExprsWithLocallyDefinedTypes.end(),
+                                        ExpandedFromBody);
+                }
+
+                R.DoesBodyContainDeclRefExpr = !A.BodyDeclRefExprs.empty();
+
+                // Collect the declarations of the types of subexpressions
+                // expanded from the body, so that we can later check whether
+                // any were defined after the macro
+                for (auto &&St : StmtsExpandedFromBody)
+                        if (auto E = clang::dyn_cast<clang::Expr>(St))
+                                isInType(E->getType().getTypePtrOrNull(), Ctx,
+                                         [&A](const clang::Type *T) {
+                                                 if (auto D = getTypeDeclOrNull(
+                                                             T))
+                                                         A.BodyTypeDecls
+                                                                 .insert(D);
+                                                 return false;
+                                         });
+
+                R.IsInvokedWhereModifiableValueRequired = std::any_of(
+                        SideEffectExprs.begin(), SideEffectExprs.end(),
+                        [&ST, &ExpandedFromBody](const clang::Expr *E) {
+                                // Only consider side-effect expressions which
+                                // were not expanded from the body of the same
+                                // macro
+                                if (!ExpandedFromBody(E)) {
+                                        clang::Expr *LHS = nullptr;
+                                        auto B = clang::dyn_cast<
+                                                clang::BinaryOperator>(E);
+                                        auto U = clang::dyn_cast<
+                                                clang::UnaryOperator>(E);
+                                        if (B)
+                                                LHS = B->getLHS();
+                                        else if (U)
+                                                LHS = U->getSubExpr();
+                                        return inTree(ST, LHS);
+                                }
+                                return false;
+                        });
+
+                R.IsInvokedWhereAddressableValueRequired = std::any_of(
+                        AddressOfExprs.begin(), AddressOfExprs.end(),
+                        [&ST,
+                         &ExpandedFromBody](const clang::UnaryOperator *U) {
+                                // Only consider address of expressions which
+                                // were not expanded from the body of the same
+                                // macro
+                                if (!ExpandedFromBody(U)) {
+                                        auto Operand = U->getSubExpr();
+                                        Operand =
+                                                skipImplicitAndParens(Operand);
+                                        return inTree(ST, Operand);
+                                }
+                                return false;
+                        });
+        }
+
+        // Check every Stmt expanded from the macro, i.e., from either its
+        // body or its arguments.
+        // If the subtrees of the aligned roots were summarized, only check
+        // the roots, since the Stmts expanded from the macro are exactly the
+        // Stmts under them.
+        if (Sets.SummarizedJumps) {
+                auto ContainsJump = [&Sets](const clang::Stmt *St) {
+                        return St && Sets.SubtreeContainsJump.lookup(St);
+                };
+                R.IsExpansionControlFlowStmt =
+                        A.AnalyzedBody && ContainsJump(Exp->AlignedRoot->ST);
+                if (R.HasAlignedArguments)
+                        for (auto &&Arg : Exp->Arguments)
+                                for (auto &&Root : Arg.AlignedRoots)
+                                        R.IsExpansionControlFlowStmt |=
+                                                ContainsJump(Root.ST);
+                return;
+        }
+        R.IsExpansionControlFlowStmt =
+                std::any_of(StmtsExpandedFromBody.begin(),
+                            StmtsExpandedFromBody.end(), isJump) ||
+                std::any_of(StmtsExpandedFromArguments.begin(),
+                            StmtsExpandedFromArguments.end(), isJump);
+}
+
+llvm::StringRef Cpp2CASTConsumer::typeString(clang::ASTContext &Ctx,
+                                             clang::QualType QT) {
+        auto CT = QT.getDesugaredType(Ctx)
+                          .getUnqualifiedType()
+                          .getCanonicalType();
+        auto It = TypeStrings.find(CT);
+        if (It == TypeStrings.end())
+                It = TypeStrings
+                             .insert({ CT, TypeStringsSaver.save(
+                                                   CT.getAsString()) })
+                             .first;
+        return It->second;
+}
+
+void Cpp2CASTConsumer::analyzeDefinition(
+        clang::ASTContext &Ctx, cpp2c::MacroExpansionNode *Exp,
+        std::vector<const clang::Decl *> &TopLevelDecls,
+        DefinitionProperties &P) {
+        auto &SM = Ctx.getSourceManager();
+
+        P.HasSameNameAsOtherDeclaration =
+                // First check if any macro defined before this macro
+                // has the same name as any of this macro's parameters
+                std::any_of(
+                        DC->MacroNamesDefinitions.begin(),
+                        DC->MacroNamesDefinitions.end(),
+                        [&SM, &Exp](std::pair<const clang::IdentifierInfo *,
+                                              const clang::MacroDirective *>
+                                            Entry) {
+                                return SM.isBeforeInTranslationUnit(
+                                               SM.getFileLoc(
+                                                       Entry.second
+                                                               ->getDefinition()
+                                                               .getLocation()),
+                                               SM.getFileLoc(
+                                                       Exp->MI->getDefinitionLoc())) &&
+                                       std::any_of(
+                                               Exp->Arguments.begin(),
+                                               Exp->Arguments.end(),
+                                               [&Entry](const MacroExpansionArgument
+                                                                &Arg) {
+                                                       auto II = Entry.first;
+                                                       return Arg.Name ==
+                                                              II->getName();
+                                               });
+                        }) ||
+                // Also check if any global declarations defined before
+                // this macro have the same name as this macro
+                std::any_of(TopLevelDecls.begin(), TopLevelDecls.end(),
+                            [&SM, &Exp](const clang::Decl *D) {
+                                    auto ND = clang::dyn_cast_or_null<
+                                            clang::NamedDecl>(D);
+                                    if (!ND)
+                                            return false;
+                                    auto II = ND->getIdentifier();
+                                    if (!II)
+                                            return false;
+                                    return II->getName().str() ==
+                                                   Exp->Name.str() &&
+                                           SM.isBeforeInTranslationUnit(
+                                                   SM.getFileLoc(
+                                                           D->getBeginLoc()),
+                                                   SM.getFileLoc(
+                                                           Exp->MI->getDefinitionLoc()));
+                            });
+        // NOTE: In incremental mode, this only reflects the
+        // conditionals seen so far; the InspectedByCPP results
+        // printed at the end of the translation unit are complete
+        P.IsNamePresentInCPPConditional =
+                DC->InspectedMacroNames.count(Exp->NameInfo);
+
+        // Definition location
+        auto Res = tryGetFullSourceLoc(SM, Exp->MI->getDefinitionLoc());
+        P.IsDefinitionLocationValid = Res.first;
+        if (P.IsDefinitionLocationValid)
+                P.DefinitionLocation = Res.second;
+        auto EndRes = tryGetFullSourceLoc(SM, Exp->MI->getDefinitionEndLoc());
+        if (EndRes.first)
+                P.EndDefinitionLocation = EndRes.second;
+}
+
+void Cpp2CASTConsumer::analyzeInContext(
+        clang::ASTContext &Ctx, cpp2c::MacroExpansionNode *Exp,
+        std::vector<const clang::Decl *> &TopLevelDecls,
+        ExpansionAnalysis &A) {
+        auto &SM = Ctx.getSourceManager();
+        auto &R = A.Record;
+
+        R.Name = Exp->Name.str();
+        R.InvocationDepth = Exp->Depth;
+        R.NumArguments = Exp->Arguments.size();
+        R.HasStringification = Exp->HasStringification;
+        R.HasTokenPasting = Exp->HasTokenPasting;
+        R.IsObjectLike = Exp->MI->isObjectLike();
+        R.IsInvokedInMacroArgument = Exp->InMacroArg;
+
+        // Many expansions invoke the same macro, so on the fast engine, only
+        // compute the properties of each definition once.
+        // Only these are cached: the properties of the aligned nodes depend
+        // on the decls and types they refer to, so two expansions with the
+        // same subtree shape and argument types may still differ in them.
+        DefinitionProperties Def;
+        if (Opts.AnalysisEngine == Engine::Fast) {
+                auto Key = std::make_pair(
+                        static_cast<const clang::MacroInfo *>(Exp->MI),
+                        unsigned(Exp->Arguments.size()));
+                auto It = DefinitionCache.find(Key);
+                if (It == DefinitionCache.end()) {
+                        analyzeDefinition(Ctx, Exp, TopLevelDecls, Def);
+                        DefinitionCache[Key] = Def;
+                } else {
+                        Def = It->second;
+                        NumDefinitionCacheHits++;
+                }
+        } else
+                analyzeDefinition(Ctx, Exp, TopLevelDecls, Def);
+        R.HasSameNameAsOtherDeclaration = Def.HasSameNameAsOtherDeclaration;
+        R.IsNamePresentInCPPConditional = Def.IsNamePresentInCPPConditional;
+        R.IsDefinitionLocationValid = Def.IsDefinitionLocationValid;
+        R.DefinitionLocation = std::move(Def.DefinitionLocation);
+        R.EndDefinitionLocation = std::move(Def.EndDefinitionLocation);
+
+        // Invocation location
+        auto InvRes = tryGetFullSourceLoc(SM, Exp->SpellingRange.getBegin());
+        R.IsInvocationLocationValid = InvRes.first;
+        if (R.IsInvocationLocationValid)
+                R.InvocationLocation = InvRes.second;
+
+        auto DefLoc = SM.getFileLoc(Exp->MI->getDefinitionLoc());
+
+        // Check if any macro this macro invokes were defined after
+        // this macro was.
+        // On the fast engine, it suffices to compare with the latest
+        // definition among the descendants, unless some definition cannot be
+        // ordered.
+        if (Opts.AnalysisEngine == Engine::Fast &&
+            !Exp->HasDescendantWithoutDefinitionLoc && DefLoc.isValid()) {
+                auto Latest = Exp->LatestDescendantDefinitionLoc;
+                R.DoesBodyReferenceMacroDefinedAfterMacro =
+                        Latest.isValid() &&
+                        SM.isBeforeInTranslationUnit(DefLoc, Latest);
+        } else {
                 auto Descendants = Exp->getDescendants();
 
-                DoesBodyReferenceMacroDefinedAfterMacro = std::any_of(
+                R.DoesBodyReferenceMacroDefinedAfterMacro = std::any_of(
                         Descendants.begin(), Descendants.end(),
                         [&SM, &Exp](MacroExpansionNode *Desc) {
                                 return SM.isBeforeInTranslationUnit(
@@ -699,590 +1526,466 @@ void Cpp2CASTConsumer::HandleTranslationUnit(clang::ASTContext &Ctx) {
                                         SM.getFileLoc(
                                                 Desc->MI->getDefinitionLoc()));
                         });
+        }
+
+        if (!A.AnalyzedBody)
+                return;
+
+        auto ST = Exp->AlignedRoot->ST;
+
+        // NOTE: This may not be correct if the definition of of the decl is
+        // separate from its declaration.
+        if (A.RankedBodyDecls && DefLoc.isValid()) {
+                // The number of ranked decl locations that are not after the
+                // definition is the least rank that is
+                auto After = std::upper_bound(
+                        OrderedDeclLocs.begin(), OrderedDeclLocs.end(), DefLoc,
+                        [&SM](clang::SourceLocation L,
+                              clang::SourceLocation R) {
+                                return SM.isBeforeInTranslationUnit(L, R);
+                        });
+                R.DoesBodyReferenceDeclDeclaredAfterMacro =
+                        A.LatestBodyDeclRank > After - OrderedDeclLocs.begin();
+        } else
+                R.DoesBodyReferenceDeclDeclaredAfterMacro = std::any_of(
+                        A.BodyDeclRefExprs.begin(), A.BodyDeclRefExprs.end(),
+                        [&SM, &DefLoc](const clang::DeclRefExpr *DRE) {
+                                auto D = DRE->getDecl();
+                                auto DeclLoc =
+                                        SM.getFileLoc(D->getLocation());
+                                return SM.isBeforeInTranslationUnit(DefLoc,
+                                                                    DeclLoc);
+                        });
+
+        R.DoesSubexpressionExpandedFromBodyHaveTypeDefinedAfterMacro =
+                std::any_of(A.BodyTypeDecls.begin(), A.BodyTypeDecls.end(),
+                            [&SM, &DefLoc](const clang::Decl *D) {
+                                    return isDeclaredAfter(SM, D, DefLoc);
+                            });
+
+        // We only allow references to declarations declared within the macro
+        // expansion itself
+        R.IsHygienic = std::none_of(
+                A.BodyLocalDeclRefExprs.begin(),
+                A.BodyLocalDeclRefExprs.end(),
+                [&ST, &SM](const clang::DeclRefExpr *DRE) {
+                        auto B = SM.getFileLoc(ST->getBeginLoc());
+                        auto E = SM.getFileLoc(ST->getEndLoc());
+                        auto D = DRE->getDecl();
+                        if (!D)
+                                return false;
+
+                        auto L = SM.getFileLoc(D->getLocation());
+                        // NOTE: It would be nice if we could instead walk
+                        // the AST and check if this decl is under the AST
+                        // aligned with this macro. This should work for now
+                        // though.
+                        return !clang::SourceRange(B, E).fullyContains(L);
+                });
+
+        R.IsInvokedWhereICERequired =
+                Opts.AnalysisEngine == Engine::Fast ?
+                        isDescendantOfStmtRequiringICE(Ctx, Index, ST) :
+                        isDescendantOfStmtRequiringICE(Ctx, ST);
+
+        //// Generate type signature
+
+        // Body type information
+        auto &Sig = SignatureBuffer;
+        Sig.clear();
+        llvm::StringRef BodyTypeStr = "void";
+        if (auto E = clang::dyn_cast<clang::Expr>(ST)) {
+                // Type information about the entire expansion
+                auto QT = E->getType();
+                auto T = QT.getTypePtrOrNull();
+                R.IsExpansionTypeNull = QT.isNull() || T == nullptr;
+
+                if (T) {
+                        R.IsExpansionTypeVoid = T->isVoidType();
+                        R.IsExpansionTypeAnonymous = hasAnonymousType(T, Ctx);
+                        R.IsExpansionTypeLocalType = hasLocalType(T, Ctx);
+                        BodyTypeStr = typeString(Ctx, QT);
+                }
+                R.IsExpansionTypeDefinedAfterMacro = hasTypeDefinedAfter(
+                        QT.getTypePtrOrNull(), Ctx, DefLoc);
+
+                // Whether this expression is an integral constant expression
+                R.IsExpansionICE = E->isIntegerConstantExpr(Ctx);
+        }
+        Sig += BodyTypeStr;
+        // Macro identifier
+        Sig += " ";
+        Sig += R.Name;
 
-                // Next get AST information for top level invocations
+        // Argument type information
+        if (Exp->MI->isFunctionLike() &&
+            (R.ASTKind == "Stmt" || R.ASTKind == "Expr"))
+                Sig += "(";
+        debug("Iterating arguments");
+        int ArgNum = 0;
+        for (auto &&Arg : Exp->Arguments) {
+                if (ArgNum != 0)
+                        Sig += ", ";
+                ArgNum += 1;
+
+                R.IsAnyArgumentNeverExpanded = Arg.AlignedRoots.empty();
+
+                if (Arg.AlignedRoots.empty())
+                        continue;
+
+                auto Arg1stExpST = Arg.AlignedRoots.front().ST;
+                auto E = clang::dyn_cast_or_null<clang::Expr>(Arg1stExpST);
+
+                R.IsAnyArgumentNotAnExpression |= (E == nullptr);
+
+                debug("Checking if argument is an expression");
+
+                if (!E)
+                        continue;
+
+                llvm::StringRef ArgTypeStr = "<Null>";
+
+                // Type information about arguments
+                auto QT = E->getType();
+                auto T = QT.getTypePtrOrNull();
+                R.IsAnyArgumentTypeNull |= QT.isNull() || T == nullptr;
+
+                if (T) {
+                        R.IsAnyArgumentTypeVoid = T->isVoidType();
+                        R.IsAnyArgumentTypeAnonymous = hasAnonymousType(T, Ctx);
+                        R.IsAnyArgumentTypeLocalType = hasLocalType(T, Ctx);
+                        ArgTypeStr = typeString(Ctx, QT);
+                }
+                R.IsAnyArgumentTypeDefinedAfterMacro |= hasTypeDefinedAfter(
+                        QT.getTypePtrOrNull(), Ctx, DefLoc);
+
+                Sig += ArgTypeStr;
+                Sig += " ";
+                Sig += Arg.Name;
+        }
+        debug("Finished iterating arguments");
+        if (Exp->MI->isFunctionLike() &&
+            (R.ASTKind == "Stmt" || R.ASTKind == "Expr"))
+                Sig += ")";
+        R.TypeSignature = Sig.str().str();
+}
+
+void Cpp2CASTConsumer::emitExpansions(
+        clang::ASTContext &Ctx,
+        std::vector<cpp2c::MacroExpansionNode *> &Expansions,
+        std::vector<const clang::Decl *> &TopLevelDecls) {
+        Timer.enter(PhaseTimer::Collect);
+        ASTNodeSets Sets;
+        if (Opts.AnalysisEngine == Engine::Fast) {
+                // Only traverse the parts of the AST that these expansions
+                // may have expanded to
+                Regions.build(Ctx.getSourceManager(), Expansions,
+                              IC->IncludeEntriesLocs);
+                Sets = collectASTNodeSets(Ctx, Regions);
+                Index.build(Ctx, Regions);
+
+                // The expansions nested under these are all complete now
+                for (auto &&Exp : Expansions)
+                        if (Exp->Depth == 0)
+                                Exp->summarizeDescendants(
+                                        Ctx.getSourceManager());
+        } else
+                Sets = collectASTNodeSets(Ctx);
+
+        // Align all top-level expansions first, in order, since the nodes an
+        // expansion may align with depend on the expansions aligned before it
+        Timer.enter(PhaseTimer::Align);
+        // No AST node contains the tokens of an expansion in a directive, so
+        // the fast engine does not try to align them
+        std::vector<cpp2c::MacroExpansionNode *> TopLevelExpansions;
+        for (auto Exp : Expansions) {
+                assert(Exp);
+                assert(Exp->MI);
                 if (Exp->Depth == 0 && !Exp->InMacroArg) {
                         debug("Top level invocation: ", Exp->Name.str());
-                        cpp2c::findAlignedASTNodesForExpansion(Exp, Ctx);
-
-                        //// Print macro info
-
-                        // Exp->dumpMacroInfo(llvm::outs());
-
-                        // Exp->dumpASTInfo(llvm::outs(),
-                        //                  Ctx.getSourceManager(),
-                        //                  Ctx.getLangOpts());
-
-                        // Number of AST roots
-                        NumASTRoots = Exp->ASTRoots.size();
-
-                        // Determine the AST kind of the expansion
-                        debug("Checking if expansion has aligned root");
-                        if (Exp->AlignedRoot) {
-                                auto D = Exp->AlignedRoot->D;
-                                auto ST = Exp->AlignedRoot->ST;
-                                auto TL = Exp->AlignedRoot->TL;
-
-                                if (ST) {
-                                        debug("Aligns with a stmt");
-                                        ASTKind = "Stmt";
-                                } else if (D) {
-                                        debug("Aligns with a decl");
-                                        ASTKind = "Decl";
-                                } else if (TL) {
-                                        debug("Aligns with a type loc");
-                                        ASTKind = "TypeLoc";
-                                        // Check that this type specifier list
-                                        // does not include a typedef that was
-                                        // defined after the macro was defined
-                                        // debug("Checking if type loc type is
-                                        // null");
-                                        IsExpansionTypeNull = TL->isNull();
-
-                                        // FIXME: For some reason, this function
-                                        // call sometimes triggers an error. I
-                                        // have tried to debug it the best I
-                                        // can, but it seems to be due to a
-                                        // problem with Clang. Until this is
-                                        // fixed, we will not be able to gather
-                                        // full data on TypeLocs.
-                                        // debug("Checking
-                                        // hasTypeDefinedAfter");
-                                        // IsExpansionTypeDefinedAfterMacro =
-                                        // (!TL->isNull()) &&
-                                        //     hasTypeDefinedAfter(TL->getTypePtr(),
-                                        //     Ctx, DefLoc);
-                                        // debug("Finished checking
-                                        // hasTypeDefinedAfter");
-                                } else
-                                        assert("Aligns with node that is not a Decl/Stmt/TypeLoc");
-                        }
+                        if (Opts.AnalysisEngine == Engine::Fast &&
+                            Exp->InDirective)
+                                continue;
+                        TopLevelExpansions.push_back(Exp);
+                }
+        }
+        cpp2c::findAlignedASTNodesForExpansions(TopLevelExpansions, Alignment);
+
+        // Summarize which aligned subtrees contain jumps, so that analyzing
+        // an expansion only has to check its aligned roots
+        if (Opts.AnalysisEngine == Engine::Fast) {
+                for (auto &&Exp : TopLevelExpansions) {
+                        if (Exp->AlignedRoot)
+                                summarizeJumps(Exp->AlignedRoot->ST,
+                                               Sets.SubtreeContainsJump);
+                        for (auto &&Arg : Exp->Arguments)
+                                for (auto &&Root : Arg.AlignedRoots)
+                                        summarizeJumps(
+                                                Root.ST,
+                                                Sets.SubtreeContainsJump);
+                }
+                Sets.SummarizedJumps = true;
+                indexSubtrees(TopLevelExpansions, Sets);
+                rankReferencedDecls(Ctx.getSourceManager(), Sets,
+                                    OrderedDeclLocs);
+                Sets.Subtrees.finish();
+                Sets.IndexedSubtrees = true;
+        }
 
-                        // Check that the number of AST nodes aligned with each
-                        // argument equals the number of times that argument was
-                        // expanded
-                        debug("Checking if arguments are all aligned");
-                        HasAlignedArguments = std::all_of(
-                                Exp->Arguments.begin(), Exp->Arguments.end(),
-                                [](MacroExpansionArgument Arg) {
-                                        return Arg.AlignedRoots.size() ==
-                                               Arg.NumExpansions;
-                                });
-                        debug("Done checking if arguments are all aligned");
-
-                        std::set<const clang::Stmt *> StmtsExpandedFromArguments;
-                        // Semantic properties of the macro's arguments
-                        if (HasAlignedArguments) {
-                                debug("Collecting argument subtrees");
-                                for (auto &&Arg : Exp->Arguments) {
-                                        for (auto &&Root : Arg.AlignedRoots) {
-                                                auto STs = subtrees(Root.ST);
-                                                StmtsExpandedFromArguments
-                                                        .insert(STs.begin(),
-                                                                STs.end());
-                                        }
-                                }
-                                debug("Done collecting argument subtrees");
-
-                                auto ExpandedFromArgument =
-                                        [&StmtsExpandedFromArguments](
-                                                const clang::Stmt *St) {
-                                                return StmtsExpandedFromArguments
-                                                               .find(St) !=
-                                                       StmtsExpandedFromArguments
-                                                               .end();
-                                        };
-
-                                DoesAnyArgumentHaveSideEffects =
-                                        std::any_of(SideEffectExprs.begin(),
-                                                    SideEffectExprs.end(),
-                                                    ExpandedFromArgument);
-
-                                DoesAnyArgumentContainDeclRefExpr =
-                                        std::any_of(AllDeclRefExprs.begin(),
-                                                    AllDeclRefExprs.end(),
-                                                    ExpandedFromArgument);
-
-                                IsAnyArgumentExpandedWhereModifiableValueRequired = std::any_of(
-                                        SideEffectExprs.begin(),
-                                        SideEffectExprs.end(),
-                                        [&ExpandedFromArgument](
-                                                const clang::Expr *E) {
-                                                // Only consider side-effect
-                                                // expressions which were not
-                                                // expanded from an argument of
-                                                // the same macro
-                                                if (!ExpandedFromArgument(E)) {
-                                                        clang::Expr *LHS =
-                                                                nullptr;
-                                                        auto B = clang::dyn_cast<
-                                                                clang::BinaryOperator>(
-                                                                E);
-                                                        auto U = clang::dyn_cast<
-                                                                clang::UnaryOperator>(
-                                                                E);
-                                                        if (B)
-                                                                LHS = B->getLHS();
-                                                        else if (U)
-                                                                LHS = U->getSubExpr();
-                                                        LHS = skipImplicitAndParens(
-                                                                LHS);
-                                                        return ExpandedFromArgument(
-                                                                LHS);
-                                                }
-                                                return false;
-                                        });
-
-                                IsAnyArgumentExpandedWhereAddressableValueRequired = std::any_of(
-                                        AddressOfExprs.begin(),
-                                        AddressOfExprs.end(),
-                                        [&ExpandedFromArgument](
-                                                const clang::UnaryOperator *U) {
-                                                // Only consider address of
-                                                // expressions which were not
-                                                // expanded from an argument of
-                                                // the same macro
-                                                if (!ExpandedFromArgument(U)) {
-                                                        auto Operand =
-                                                                U->getSubExpr();
-                                                        Operand =
-                                                                skipImplicitAndParens(
-                                                                        Operand);
-                                                        return ExpandedFromArgument(
-                                                                Operand);
-                                                }
-                                                return false;
-                                        });
+        // Analyze the expansions in batches, so that we only keep the
+        // intermediate results of one batch at a time
+        const size_t BatchSize = 4096;
+        for (size_t Begin = 0; Begin < Expansions.size(); Begin += BatchSize) {
+                size_t End = std::min(Begin + BatchSize, Expansions.size());
+                std::vector<ExpansionAnalysis> Analyses(End - Begin);
+
+                // Analyze the aligned AST nodes of each expansion.
+                // This only reads the AST, so split the batch into chunks and
+                // analyze them in parallel if we were given more than one job.
+                Timer.enter(PhaseTimer::Properties);
+                auto AnalyzeChunk = [&](size_t ChunkBegin, size_t ChunkEnd) {
+                        PropertyScratch Scratch;
+                        for (size_t I = ChunkBegin; I < ChunkEnd; I++) {
+                                auto Exp = Expansions[I];
+                                if (Exp->Depth == 0 && !Exp->InMacroArg)
+                                        analyzeAlignedNodes(
+                                                Exp, Ctx, Sets,
+                                                Opts.AnalysisEngine, Scratch,
+                                                Analyses[I - Begin]);
                         }
+                };
+                if (Pool) {
+                        size_t NumChunks = Pool->getThreadCount() * 4;
+                        size_t ChunkSize =
+                                std::max<size_t>(1, (End - Begin + NumChunks -
+                                                     1) / NumChunks);
+                        for (size_t I = Begin; I < End; I += ChunkSize)
+                                Pool->async(AnalyzeChunk, I,
+                                            std::min(I + ChunkSize, End));
+                        Pool->wait();
+                } else
+                        AnalyzeChunk(Begin, End);
+
+                // The remaining properties use the source manager, which is
+                // not thread-safe, so finish analyzing and print each
+                // expansion in order
+                for (size_t I = Begin; I < End; I++) {
+                        Timer.enter(PhaseTimer::Properties);
+                        NumAnalyzedExpansions++;
+                        auto &A = Analyses[I - Begin];
+                        analyzeInContext(Ctx, Expansions[I], TopLevelDecls, A);
+
+                        Timer.enter(PhaseTimer::Emit);
+                        Writer->push(potentialLeadingComma(), A.Record);
+                        EmittedOneObject = true;
+                }
+        }
 
-                        std::set<const clang::Stmt *> StmtsExpandedFromBody;
-                        // Semantic properties of the macro body
-                        if (Exp->AlignedRoot && Exp->AlignedRoot->ST &&
-                            HasAlignedArguments) {
-                                auto ST = Exp->AlignedRoot->ST;
-
-                                debug("Collecting body subtrees");
-                                StmtsExpandedFromBody = subtrees(ST);
-                                // Remove all Stmts which were actually expanded
-                                // from arguments
-                                for (auto &&St : StmtsExpandedFromArguments)
-                                        StmtsExpandedFromBody.erase(St);
-
-                                auto ExpandedFromBody = [&StmtsExpandedFromBody](
-                                                                const clang::Stmt
-                                                                        *St) {
-                                        return StmtsExpandedFromBody.find(St) !=
-                                               StmtsExpandedFromBody.end();
-                                };
-
-                                debug("Checking if any argument is conditionally "
-                                      "evaluated in the body of the expansion");
-                                IsAnyArgumentConditionallyEvaluated = std::any_of(
-                                        ConditionalExprs.begin(),
-                                        ConditionalExprs.end(),
-                                        [&ExpandedFromBody,
-                                         &StmtsExpandedFromArguments](
-                                                const clang::Expr *CE) {
-                                                return ExpandedFromBody(CE) &&
-                                                       std::any_of(
-                                                               StmtsExpandedFromArguments
-                                                                       .begin(),
-                                                               StmtsExpandedFromArguments
-                                                                       .end(),
-                                                               [&CE](const clang::Stmt
-                                                                             *ArgStmt) {
-                                                                       return inTree(
-                                                                               ArgStmt,
-                                                                               CE);
-                                                               });
-                                        });
-                                debug("Done checking if any argument is conditionally "
-                                      "evaluated in the body of the expansion");
-
-                                // NOTE: This may not be correct if the
-                                // definition of of the decl is separate from
-                                // its declaration.
-                                DoesBodyReferenceDeclDeclaredAfterMacro = std::any_of(
-                                        AllDeclRefExprs.begin(),
-                                        AllDeclRefExprs.end(),
-                                        [&SM, &DefLoc, &ExpandedFromBody](
-                                                const clang::DeclRefExpr *DRE) {
-                                                if (ExpandedFromBody(DRE)) {
-                                                        auto D = DRE->getDecl();
-                                                        auto DeclLoc = SM.getFileLoc(
-                                                                D->getLocation());
-
-                                                        return SM.isBeforeInTranslationUnit(
-                                                                DefLoc,
-                                                                DeclLoc);
-                                                }
-                                                return false;
-                                        });
-
-                                DoesBodyContainDeclRefExpr =
-                                        std::any_of(AllDeclRefExprs.begin(),
-                                                    AllDeclRefExprs.end(),
-                                                    ExpandedFromBody);
-
-                                DoesSubexpressionExpandedFromBodyHaveLocalType =
-                                        std::any_of(ExprsWithLocallyDefinedTypes
-                                                            .begin(),
-                                                    ExprsWithLocallyDefinedTypes
-                                                            .end(),
-                                                    ExpandedFromBody);
-
-                                DoesSubexpressionExpandedFromBodyHaveTypeDefinedAfterMacro =
-                                        std::any_of(
-                                                StmtsExpandedFromBody.begin(),
-                                                StmtsExpandedFromBody.end(),
-                                                [&Ctx, &DefLoc](
-                                                        const clang::Stmt *St) {
-                                                        if (auto E = clang::dyn_cast<
-                                                                    clang::Expr>(
-                                                                    St)) {
-                                                                auto QT =
-                                                                        E->getType();
-                                                                return hasTypeDefinedAfter(
-                                                                        QT.getTypePtrOrNull(),
-                                                                        Ctx,
-                                                                        DefLoc);
-                                                        }
-                                                        return false;
-                                                });
-
-                                // We only allow references to declarations
-                                // declared within the macro expansion itself
-                                IsHygienic = std::none_of(
-                                        DeclRefExprsOfLocallyDefinedDecls
-                                                .begin(),
-                                        DeclRefExprsOfLocallyDefinedDecls.end(),
-                                        [&ST, &SM, &ExpandedFromBody](
-                                                const clang::DeclRefExpr *DRE) {
-                                                // References that don't come
-                                                // from the macro's body are
-                                                // fine
-                                                if (!ExpandedFromBody(DRE))
-                                                        return false;
-
-                                                auto B = SM.getFileLoc(
-                                                        ST->getBeginLoc());
-                                                auto E = SM.getFileLoc(
-                                                        ST->getEndLoc());
-                                                auto D = DRE->getDecl();
-                                                if (!D)
-                                                        return false;
-
-                                                auto L = SM.getFileLoc(
-                                                        D->getLocation());
-                                                // NOTE: It would be nice if we
-                                                // could instead walk the AST
-                                                // and check if this decl is
-                                                // under the AST aligned with
-                                                // this macro. This should work
-                                                // for now though.
-                                                return !clang::SourceRange(B, E)
-                                                                .fullyContains(
-                                                                        L);
-                                        });
-
-                                IsInvokedWhereModifiableValueRequired = std::any_of(
-                                        SideEffectExprs.begin(),
-                                        SideEffectExprs.end(),
-                                        [&ST, &ExpandedFromBody](
-                                                const clang::Expr *E) {
-                                                // Only consider side-effect
-                                                // expressions which were not
-                                                // expanded from the body of the
-                                                // same macro
-                                                if (!ExpandedFromBody(E)) {
-                                                        clang::Expr *LHS =
-                                                                nullptr;
-                                                        auto B = clang::dyn_cast<
-                                                                clang::BinaryOperator>(
-                                                                E);
-                                                        auto U = clang::dyn_cast<
-                                                                clang::UnaryOperator>(
-                                                                E);
-                                                        if (B)
-                                                                LHS = B->getLHS();
-                                                        else if (U)
-                                                                LHS = U->getSubExpr();
-                                                        return inTree(ST, LHS);
-                                                }
-                                                return false;
-                                        });
-
-                                IsInvokedWhereAddressableValueRequired = std::any_of(
-                                        AddressOfExprs.begin(),
-                                        AddressOfExprs.end(),
-                                        [&ST, &ExpandedFromBody](
-                                                const clang::UnaryOperator *U) {
-                                                // Only consider address of
-                                                // expressions which were not
-                                                // expanded from the body of the
-                                                // same macro
-                                                if (!ExpandedFromBody(U)) {
-                                                        auto Operand =
-                                                                U->getSubExpr();
-                                                        Operand =
-                                                                skipImplicitAndParens(
-                                                                        Operand);
-                                                        return inTree(ST,
-                                                                      Operand);
-                                                }
-                                                return false;
-                                        });
-
-                                IsInvokedWhereICERequired =
-                                        isDescendantOfStmtRequiringICE(Ctx, ST);
-
-                                //// Generate type signature
-
-                                // Body type information
-                                TypeSignature = "void";
-                                if (auto E = clang::dyn_cast<clang::Expr>(ST)) {
-                                        ASTKind = "Expr";
-
-                                        // Type information about the entire
-                                        // expansion
-                                        auto QT = E->getType();
-                                        auto T = QT.getTypePtrOrNull();
-                                        IsExpansionTypeNull = QT.isNull() ||
-                                                              T == nullptr;
-
-                                        if (T) {
-                                                IsExpansionTypeVoid =
-                                                        T->isVoidType();
-                                                IsExpansionTypeAnonymous =
-                                                        hasAnonymousType(T,
-                                                                         Ctx);
-                                                IsExpansionTypeLocalType =
-                                                        hasLocalType(T, Ctx);
-                                                auto CT =
-                                                        QT.getDesugaredType(Ctx)
-                                                                .getUnqualifiedType()
-                                                                .getCanonicalType();
-                                                TypeSignature =
-                                                        CT.getAsString();
-                                        }
-                                        IsExpansionTypeDefinedAfterMacro =
-                                                hasTypeDefinedAfter(
-                                                        QT.getTypePtrOrNull(),
-                                                        Ctx, DefLoc);
-
-                                        // Whether this expression is an
-                                        // integral constant expression
-                                        IsExpansionICE =
-                                                E->isIntegerConstantExpr(Ctx);
-                                }
-                                // Macro identifier
-                                TypeSignature += " " + Name;
-
-                                // Argument type information
-                                IsAnyArgumentNotAnExpression = false;
-                                IsAnyArgumentTypeNull = false;
-                                IsAnyArgumentTypeDefinedAfterMacro = false;
-
-                                if (Exp->MI->isFunctionLike() &&
-                                    (ASTKind == "Stmt" || ASTKind == "Expr"))
-                                        TypeSignature += "(";
-                                debug("Iterating arguments");
-                                int ArgNum = 0;
-                                for (auto &&Arg : Exp->Arguments) {
-                                        if (ArgNum != 0)
-                                                TypeSignature += ", ";
-                                        ArgNum += 1;
-
-                                        IsAnyArgumentNeverExpanded =
-                                                Arg.AlignedRoots.empty();
-
-                                        if (Arg.AlignedRoots.empty())
-                                                continue;
-
-                                        auto Arg1stExpST =
-                                                Arg.AlignedRoots.front().ST;
-                                        auto E = clang::dyn_cast_or_null<
-                                                clang::Expr>(Arg1stExpST);
-
-                                        IsAnyArgumentNotAnExpression |=
-                                                (E == nullptr);
-
-                                        debug("Checking if argument is an expression");
-
-                                        if (!E)
-                                                continue;
-
-                                        std::string ArgTypeStr = "<Null>";
-
-                                        // Type information about arguments
-                                        auto QT = E->getType();
-                                        auto T = QT.getTypePtrOrNull();
-                                        IsAnyArgumentTypeNull |= QT.isNull() ||
-                                                                 T == nullptr;
-
-                                        if (T) {
-                                                IsAnyArgumentTypeVoid =
-                                                        T->isVoidType();
-                                                IsAnyArgumentTypeAnonymous =
-                                                        hasAnonymousType(T,
-                                                                         Ctx);
-                                                IsAnyArgumentTypeLocalType =
-                                                        hasLocalType(T, Ctx);
-                                                auto CT =
-                                                        QT.getDesugaredType(Ctx)
-                                                                .getUnqualifiedType()
-                                                                .getCanonicalType();
-                                                ArgTypeStr = CT.getAsString();
-                                        }
-                                        IsAnyArgumentTypeDefinedAfterMacro |=
-                                                hasTypeDefinedAfter(
-                                                        QT.getTypePtrOrNull(),
-                                                        Ctx, DefLoc);
+        // The index is only valid for the current traversal scope, and the
+        // definition properties for the declarations seen so far
+        Index.clear();
+        DefinitionCache.clear();
+        OrderedDeclLocs = {};
+}
 
-                                        TypeSignature += ArgTypeStr;
-                                        TypeSignature += " " + Arg.Name.str();
-                                }
-                                debug("Finished iterating arguments");
-                                if (Exp->MI->isFunctionLike() &&
-                                    (ASTKind == "Stmt" || ASTKind == "Expr"))
-                                        TypeSignature += ")";
+void Cpp2CASTConsumer::emitDependencies(clang::ASTContext &Ctx) {
+        if (Opts.DepsFile.empty())
+                return;
+
+        auto &SM = Ctx.getSourceManager();
+        auto &Diags = Ctx.getDiagnostics();
+        auto PathOf = [](const clang::FileEntry *FE) {
+                auto Path = FE->tryGetRealPathName();
+                return (Path.empty() ? FE->getName() : Path).str();
+        };
+
+        // Sort the paths so that the same inputs always give the same file
+        std::set<std::string> Paths;
+        if (auto FE = SM.getFileEntryForID(SM.getMainFileID()))
+                Paths.insert(PathOf(FE));
+        for (auto &&Entry : IC->IncludeEntriesLocs)
+                if (Entry.first)
+                        Paths.insert(PathOf(Entry.first));
+
+        cpp2c::AtomicOutputFile DepsFile;
+        if (auto EC = DepsFile.open(Opts.DepsFile)) {
+                auto ID = Diags.getCustomDiagID(
+                        clang::DiagnosticsEngine::Error,
+                        "cannot open dependency file '%0': %1");
+                Diags.Report(ID) << Opts.DepsFile << EC.message();
+                return;
+        }
+        for (auto &&Path : Paths)
+                DepsFile.os() << Path << "\n";
+        if (auto EC = DepsFile.commit()) {
+                auto ID = Diags.getCustomDiagID(
+                        clang::DiagnosticsEngine::Error,
+                        "cannot write dependency file '%0': %1");
+                Diags.Report(ID) << Opts.DepsFile << EC.message();
+        }
+}
+
+void Cpp2CASTConsumer::emitStats(clang::ASTContext &Ctx) {
+        if (Opts.StatsFile.empty())
+                return;
+
+        auto &Diags = Ctx.getDiagnostics();
+        cpp2c::AtomicOutputFile StatsFile;
+        if (auto EC = StatsFile.open(Opts.StatsFile)) {
+                auto ID = Diags.getCustomDiagID(
+                        clang::DiagnosticsEngine::Error,
+                        "cannot open stats file '%0': %1");
+                Diags.Report(ID) << Opts.StatsFile << EC.message();
+                return;
+        }
+        Timer.print(StatsFile.os(), NumAnalyzedExpansions,
+                    NumDefinitionCacheHits);
+        if (auto EC = StatsFile.commit()) {
+                auto ID = Diags.getCustomDiagID(
+                        clang::DiagnosticsEngine::Error,
+                        "cannot write stats file '%0': %1");
+                Diags.Report(ID) << Opts.StatsFile << EC.message();
+        }
+}
+
+bool Cpp2CASTConsumer::HandleTopLevelDecl(clang::DeclGroupRef DG) {
+        if (!Opts.Incremental || !OS || DG.isNull())
+                return true;
+
+        auto &Ctx = (*DG.begin())->getASTContext();
+        auto &SM = Ctx.getSourceManager();
+
+        // The file and offsets each declaration in the group spans.
+        // Offsets are only compared within the same file.
+        struct DeclExtent {
+                clang::FileID FID;
+                unsigned Begin, End;
+        };
+        std::vector<clang::Decl *> Scope;
+        std::vector<DeclExtent> Extents;
+        for (auto D : DG) {
+                Scope.push_back(D);
+                auto R = SM.getExpansionRange(D->getSourceRange());
+                auto B = R.getBegin(), E = R.getEnd();
+                if (B.isInvalid() || E.isInvalid() || !B.isFileID() ||
+                    !E.isFileID())
+                        continue;
+                auto DB = SM.getDecomposedLoc(B), DE = SM.getDecomposedLoc(E);
+                if (DB.first == DE.first)
+                        Extents.push_back({ DB.first, DB.second, DE.second });
+        }
+        if (Extents.empty())
+                return true;
+
+        // The end of the group. The parser may have looked ahead past it, so
+        // the expansions after it may belong to the next group.
+        auto EndFID = Extents.back().FID;
+        unsigned EndOffset = 0;
+        for (auto &&X : Extents)
+                if (X.FID == EndFID)
+                        EndOffset = std::max(EndOffset, X.End);
+        auto GroupEnd = SM.getComposedLoc(EndFID, EndOffset);
+
+        // Only analyze expansions this group of declarations fully encloses.
+        // We require the expansion to lie strictly inside the declarations
+        // so that all the tokens it expands to belong to them.
+        // Top-level expansions are recorded in translation unit order, and
+        // top-level declarations are handled in the same order, so an
+        // expansion before the end of this group that it does not enclose
+        // is not inside any later group either, and is never checked again.
+        auto &Forest = MF->Expansions;
+        auto Begin = FirstUncheckedExpansion, End = Begin;
+        std::set<cpp2c::MacroExpansionNode *> Roots;
+        for (; End < Forest.size(); End++) {
+                auto Exp = Forest[End];
+                auto ExpB = Exp->SpellingRange.getBegin();
+                auto ExpE = Exp->SpellingRange.getEnd();
+                if (Exp->Depth != 0 || ExpB.isInvalid() || ExpE.isInvalid() ||
+                    !ExpB.isFileID() || !ExpE.isFileID())
+                        continue;
+                auto DB = SM.getDecomposedLoc(ExpB);
+                auto DE = SM.getDecomposedLoc(ExpE);
+                if (DB.first == EndFID ?
+                            DB.second >= EndOffset :
+                            !SM.isBeforeInTranslationUnit(ExpB, GroupEnd))
+                        break;
+                if (DB.first != DE.first)
+                        continue;
+                for (auto &&X : Extents)
+                        if (X.FID == DB.first && X.Begin < DB.second &&
+                            DE.second < X.End) {
+                                Roots.insert(Exp);
+                                break;
                         }
+        }
+        if (Roots.empty()) {
+                FirstUncheckedExpansion = End;
+                return true;
+        }
 
-                        // Set of all Stmts expanded from macro
-                        std::set<const clang::Stmt *> AllStmtsExpandedFromMacro =
-                                StmtsExpandedFromBody;
-                        AllStmtsExpandedFromMacro.insert(
-                                StmtsExpandedFromArguments.begin(),
-                                StmtsExpandedFromArguments.end());
-
-                        IsExpansionControlFlowStmt = std::any_of(
-                                AllStmtsExpandedFromMacro.begin(),
-                                AllStmtsExpandedFromMacro.end(),
-                                [](const clang::Stmt *St) {
-                                        return llvm::isa_and_nonnull<
-                                                       clang::ReturnStmt>(St) ||
-                                               llvm::isa_and_nonnull<
-                                                       clang::ContinueStmt>(
-                                                       St) ||
-                                               llvm::isa_and_nonnull<
-                                                       clang::BreakStmt>(St) ||
-                                               llvm::isa_and_nonnull<
-                                                       clang::GotoStmt>(St);
-                                });
-                }
+        // Limit AST traversals to the given declarations
+        Timer.enter(PhaseTimer::Collect);
+        Ctx.setTraversalScope(Scope);
+
+        auto Decls = collectDecls(Ctx);
+        SeenDecls.insert(SeenDecls.end(), Decls.begin(), Decls.end());
+
+        // The expansions nested under a top-level expansion are recorded
+        // right after it, before the next top-level expansion
+        std::vector<cpp2c::MacroExpansionNode *> Expansions;
+        bool InRoot = false;
+        for (auto I = Begin; I < End; I++) {
+                if (Forest[I]->Depth == 0)
+                        InRoot = Roots.find(Forest[I]) != Roots.end();
+                if (InRoot)
+                        Expansions.push_back(Forest[I]);
+        }
+        emitExpansions(Ctx, Expansions, SeenDecls);
 
-                std::vector<std::pair<std::string, std::string> >
-                        stringEntries = {
-                                { "Name", Name },
-                                { "DefinitionLocation", DefinitionLocation },
-                                { "EndDefinitionLocation",
-                                  EndDefinitionLocation },
-                                { "InvocationLocation", InvocationLocation },
-                                { "ASTKind", ASTKind },
-                                { "TypeSignature", TypeSignature },
-                        };
-
-                std::vector<std::pair<std::string, int> > intEntries = {
-                        { "InvocationDepth", InvocationDepth },
-                        { "NumASTRoots", NumASTRoots },
-                        { "NumArguments", NumArguments },
-                };
+        // Free the expansions we just emitted. They all came before the
+        // first unchecked expansion, so it moves back by as many.
+        auto NumExpansions = Forest.size();
+        MF->releaseExpansions(Roots);
+        FirstUncheckedExpansion = End - (NumExpansions - Forest.size());
 
-                std::vector<std::pair<std::string, bool> > boolEntries = {
-                        { "HasStringification", HasStringification },
-                        { "HasTokenPasting", HasTokenPasting },
-                        { "HasAlignedArguments", HasAlignedArguments },
-                        { "HasSameNameAsOtherDeclaration",
-                          HasSameNameAsOtherDeclaration },
-
-                        { "IsExpansionControlFlowStmt",
-                          IsExpansionControlFlowStmt },
-
-                        { "DoesBodyReferenceMacroDefinedAfterMacro",
-                          DoesBodyReferenceMacroDefinedAfterMacro },
-                        { "DoesBodyReferenceDeclDeclaredAfterMacro",
-                          DoesBodyReferenceDeclDeclaredAfterMacro },
-                        { "DoesBodyContainDeclRefExpr",
-                          DoesBodyContainDeclRefExpr },
-                        { "DoesSubexpressionExpandedFromBodyHaveLocalType",
-                          DoesSubexpressionExpandedFromBodyHaveLocalType },
-                        { "DoesSubexpressionExpandedFromBodyHaveTypeDefinedAfterMacro",
-                          DoesSubexpressionExpandedFromBodyHaveTypeDefinedAfterMacro },
-
-                        { "DoesAnyArgumentHaveSideEffects",
-                          DoesAnyArgumentHaveSideEffects },
-                        { "DoesAnyArgumentContainDeclRefExpr",
-                          DoesAnyArgumentContainDeclRefExpr },
-
-                        { "IsHygienic", IsHygienic },
-                        { "IsDefinitionLocationValid",
-                          IsDefinitionLocationValid },
-                        { "IsInvocationLocationValid",
-                          IsInvocationLocationValid },
-                        { "IsObjectLike", IsObjectLike },
-                        { "IsInvokedInMacroArgument",
-                          IsInvokedInMacroArgument },
-                        { "IsNamePresentInCPPConditional",
-                          IsNamePresentInCPPConditional },
-                        { "IsExpansionICE", IsExpansionICE },
-
-                        { "IsExpansionTypeNull", IsExpansionTypeNull },
-                        { "IsExpansionTypeAnonymous",
-                          IsExpansionTypeAnonymous },
-                        { "IsExpansionTypeLocalType",
-                          IsExpansionTypeLocalType },
-                        { "IsExpansionTypeDefinedAfterMacro",
-                          IsExpansionTypeDefinedAfterMacro },
-                        { "IsExpansionTypeVoid", IsExpansionTypeVoid },
-
-                        { "IsAnyArgumentTypeNull", IsAnyArgumentTypeNull },
-                        { "IsAnyArgumentTypeAnonymous",
-                          IsAnyArgumentTypeAnonymous },
-                        { "IsAnyArgumentTypeLocalType",
-                          IsAnyArgumentTypeLocalType },
-                        { "IsAnyArgumentTypeDefinedAfterMacro",
-                          IsAnyArgumentTypeDefinedAfterMacro },
-                        { "IsAnyArgumentTypeVoid", IsAnyArgumentTypeVoid },
-
-                        { "IsInvokedWhereModifiableValueRequired",
-                          IsInvokedWhereModifiableValueRequired },
-                        { "IsInvokedWhereAddressableValueRequired",
-                          IsInvokedWhereAddressableValueRequired },
-                        { "IsInvokedWhereICERequired",
-                          IsInvokedWhereICERequired },
-
-                        { "IsAnyArgumentExpandedWhereModifiableValueRequired",
-                          IsAnyArgumentExpandedWhereModifiableValueRequired },
-                        { "IsAnyArgumentExpandedWhereAddressableValueRequired",
-                          IsAnyArgumentExpandedWhereAddressableValueRequired },
-                        { "IsAnyArgumentConditionallyEvaluated",
-                          IsAnyArgumentConditionallyEvaluated },
-                        { "IsAnyArgumentNeverExpanded",
-                          IsAnyArgumentNeverExpanded },
-                        { "IsAnyArgumentNotAnExpression",
-                          IsAnyArgumentNotAnExpression },
-                };
+        Ctx.setTraversalScope({ Ctx.getTranslationUnitDecl() });
+        Timer.enter(PhaseTimer::Parse);
+        return true;
+}
+
+void Cpp2CASTConsumer::HandleTranslationUnit(clang::ASTContext &Ctx) {
+        // Nowhere to write results to
+        if (!OS)
+                return;
+        auto &Out = *OS;
 
-                llvm::outs() << potentialLeadingComma() << '{' << sep
-                             << "\"PropertiesOf\" : \"Invocation\"," << sep;
-                for (auto &&e : stringEntries)
-                        llvm::outs()
-                                << entryString(e.first, e.second) << "," << sep;
-                for (auto &&e : intEntries)
-                        llvm::outs()
-                                << entryInt(e.first, e.second) << "," << sep;
-                for (size_t i = 0; i < boolEntries.size(); i++) {
-                        auto e = boolEntries[i];
-                        llvm::outs()
-                                << entryBool(e.first, e.second)
-                                << (i == (boolEntries.size() - 1) ? "" : ",")
-                                << sep;
+        // Collect declaration ranges
+        Timer.enter(PhaseTimer::Collect);
+        std::vector<const clang::Decl *> TopLevelDecls = collectDecls(Ctx);
+
+        emitPreprocessorInfo(Ctx, TopLevelDecls);
+
+        // Print information for all remaining macro expansions.
+        // In incremental mode, these are only the expansions that did not
+        // occur inside a single top-level declaration.
+        emitExpansions(Ctx, MF->Expansions, TopLevelDecls);
+
+        Timer.enter(PhaseTimer::Emit);
+        Writer->finish();
+        Out << "]\n";
+
+        // Move the finished results to their destination
+        if (OutputFile.isOpen())
+                if (auto EC = OutputFile.commit()) {
+                        auto &Diags = Ctx.getDiagnostics();
+                        auto ID = Diags.getCustomDiagID(
+                                clang::DiagnosticsEngine::Error,
+                                "cannot write output file '%0': %1");
+                        Diags.Report(ID) << Opts.OutputFile << EC.message();
                 }
-                llvm::outs() << " }\n";
-                emittedOneObject = true;
-        }
 
-        llvm::outs() << "]\n";
+        emitDependencies(Ctx);
+        emitStats(Ctx);
 
         // Only delete top level expansions since deconstructor deletes
         // nested expansions
@@ -1,21 +1,159 @@
 #pragma once
 
+#include "ASTIndex.hh"
+#include "AlignmentState.hh"
+#include "AtomicOutputFile.hh"
+#include "Cpp2COptions.hh"
 #include "DefinitionInfoCollector.hh"
 #include "IncludeCollector.hh"
+#include "InvocationRecord.hh"
 #include "MacroForest.hh"
+#include "PathFilter.hh"
+#include "PhaseTimer.hh"
+#include "PrunedTraversal.hh"
+#include "RecordWriter.hh"
 
+#include "clang/AST/Type.h"
 #include "clang/Frontend/ASTConsumers.h"
 #include "clang/Frontend/CompilerInstance.h"
 
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/StringSaver.h"
+#include "llvm/Support/ThreadPool.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+
 namespace cpp2c {
+struct ExpansionAnalysis;
+
 class Cpp2CASTConsumer : public clang::ASTConsumer {
     private:
+        // The properties of an invocation that only depend on the definition
+        // of the invoked macro, its number of arguments, and the macros and
+        // declarations seen before the expansions being emitted
+        struct DefinitionProperties {
+                std::string DefinitionLocation, EndDefinitionLocation;
+                bool HasSameNameAsOtherDeclaration = false;
+                bool IsDefinitionLocationValid = false;
+                bool IsNamePresentInCPPConditional = false;
+        };
+
         cpp2c::MacroForest *MF;
         cpp2c::IncludeCollector *IC;
         cpp2c::DefinitionInfoCollector *DC;
+        cpp2c::Cpp2COptions Opts;
+        // The files whose macros are analyzed
+        cpp2c::PathFilter Filter;
+        // The nodes of the AST in the current traversal scope, if the fast
+        // engine is used
+        cpp2c::ASTIndex Index;
+        // The regions of the source files that the expansions being analyzed
+        // were invoked in, if the fast engine is used
+        cpp2c::MacroRegions Regions;
+        // The AST nodes aligned with expansions analyzed so far
+        cpp2c::AlignmentState Alignment;
+        // The file results are written to, if one was given
+        cpp2c::AtomicOutputFile OutputFile;
+        // The stream results are written to
+        llvm::raw_ostream *OS = nullptr;
+        // Formats and writes invocation results to OS on a background thread
+        std::unique_ptr<cpp2c::RecordWriter> Writer;
+        // Whether any result object has been printed yet
+        bool EmittedOneObject = false;
+        // In incremental mode, all declarations in the top-level declarations
+        // seen so far
+        std::vector<const clang::Decl *> SeenDecls;
+        // In incremental mode, the index in the macro forest of the first
+        // expansion not yet checked against a top-level declaration.
+        // The expansions before it that are still in the forest are not
+        // inside any top-level declaration, and are only emitted at the end.
+        size_t FirstUncheckedExpansion = 0;
+        // Times each phase of the analysis if a stats file was given
+        cpp2c::PhaseTimer Timer;
+        // The number of macro expansions analyzed so far
+        unsigned NumAnalyzedExpansions = 0;
+        // If the fast engine is used, the definition properties of the
+        // expansions being emitted, keyed by the invoked macro and its number
+        // of arguments
+        llvm::DenseMap<std::pair<const clang::MacroInfo *, unsigned>,
+                       DefinitionProperties>
+                DefinitionCache;
+        // The number of expansions analyzed so far whose definition
+        // properties were found in the cache
+        unsigned NumDefinitionCacheHits = 0;
+        // If the fast engine is used, the distinct file locations of the
+        // decls referred to from the Stmts aligned with the expansions being
+        // emitted, in translation unit order
+        std::vector<clang::SourceLocation> OrderedDeclLocs;
+        // The printed form of each canonical type printed so far.
+        // Expansions of the same macros mostly have the same few types, and
+        // printing a type is far slower than looking it up.
+        llvm::DenseMap<clang::QualType, llvm::StringRef> TypeStrings;
+        llvm::BumpPtrAllocator TypeStringsAllocator;
+        llvm::StringSaver TypeStringsSaver;
+        // The type signature of the expansion being analyzed, reused to avoid
+        // reallocating it for every expansion
+        llvm::SmallString<128> SignatureBuffer;
+        // The threads to analyze expansions with, if more than one job was
+        // requested
+        std::unique_ptr<llvm::ThreadPool> Pool;
+
+        // Returns the comma separating the next result object from the
+        // previous one, if any
+        char potentialLeadingComma();
+
+        // Prints information about macro definitions, macros inspected by
+        // the preprocessor, and include directives
+        void emitPreprocessorInfo(
+            clang::ASTContext &Ctx,
+            std::vector<const clang::Decl *> &TopLevelDecls);
+
+        // Returns the printed form of the canonical, unqualified type of the
+        // given type, as used in type signatures
+        llvm::StringRef typeString(clang::ASTContext &Ctx, clang::QualType QT);
+
+        // Computes the properties of the given expansion that only depend on
+        // the definition of the invoked macro
+        void analyzeDefinition(clang::ASTContext &Ctx,
+                               cpp2c::MacroExpansionNode *Exp,
+                               std::vector<const clang::Decl *> &TopLevelDecls,
+                               DefinitionProperties &P);
+
+        // Computes the properties of the given expansion that depend on the
+        // source manager or on the rest of the translation unit, after its
+        // aligned AST nodes have been analyzed
+        void analyzeInContext(clang::ASTContext &Ctx,
+                              cpp2c::MacroExpansionNode *Exp,
+                              std::vector<const clang::Decl *> &TopLevelDecls,
+                              cpp2c::ExpansionAnalysis &A);
+
+        // Prints the properties of the given macro expansions.
+        // Only AST nodes in the current traversal scope are considered.
+        void emitExpansions(
+            clang::ASTContext &Ctx,
+            std::vector<cpp2c::MacroExpansionNode *> &Expansions,
+            std::vector<const clang::Decl *> &TopLevelDecls);
+
+        // Writes the paths of the main file and all files it includes to
+        // the dependency file, if one was given
+        void emitDependencies(clang::ASTContext &Ctx);
+
+        // Writes the time and peak memory usage of each phase of the
+        // analysis to the stats file, if one was given
+        void emitStats(clang::ASTContext &Ctx);
 
     public:
-        Cpp2CASTConsumer(clang::CompilerInstance &CI);
+        // If Out is given, results are written to it instead of to the
+        // output file or stdout
+        Cpp2CASTConsumer(clang::CompilerInstance &CI,
+                         const cpp2c::Cpp2COptions &Opts,
+                         llvm::raw_ostream *Out = nullptr);
+        bool HandleTopLevelDecl(clang::DeclGroupRef DG) override;
         void HandleTranslationUnit(clang::ASTContext &Ctx) override;
 };
 
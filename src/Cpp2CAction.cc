@@ -1,15 +1,53 @@
 #include "Cpp2CAction.hh"
 #include "Cpp2CASTConsumer.hh"
 
+#include "llvm/ADT/StringExtras.h"
+
 namespace cpp2c {
 std::unique_ptr<clang::ASTConsumer>
 Cpp2CAction::CreateASTConsumer(clang::CompilerInstance &CI,
                                llvm::StringRef InFile) {
-        return std::make_unique<cpp2c::Cpp2CASTConsumer>(CI);
+        return std::make_unique<cpp2c::Cpp2CASTConsumer>(CI, Opts);
 }
 
 bool Cpp2CAction::ParseArgs(const clang::CompilerInstance &CI,
                             const std::vector<std::string> &arg) {
+        auto &Diags = CI.getDiagnostics();
+        for (auto &&A : arg) {
+                // Arguments are of the form <name>=<value>
+                auto NameValue = llvm::StringRef(A).split('=');
+                auto Name = NameValue.first;
+                auto Value = NameValue.second;
+                unsigned Jobs;
+
+                if (Name == "output" && !Value.empty())
+                        Opts.OutputFile = Value.str();
+                else if (Name == "incremental" && Value.empty())
+                        Opts.Incremental = true;
+                else if (Name == "deps" && !Value.empty())
+                        Opts.DepsFile = Value.str();
+                else if (Name == "stats" && !Value.empty())
+                        Opts.StatsFile = Value.str();
+                else if (Name == "engine" && Value == "matcher")
+                        Opts.AnalysisEngine = Engine::Matcher;
+                else if (Name == "engine" && Value == "fast")
+                        Opts.AnalysisEngine = Engine::Fast;
+                else if (Name == "jobs" && llvm::to_integer(Value, Jobs))
+                        Opts.Jobs = Jobs;
+                else if (Name == "include-path" && !Value.empty())
+                        Opts.IncludePaths.push_back(Value.str());
+                else if (Name == "exclude-path" && !Value.empty())
+                        Opts.ExcludePaths.push_back(Value.str());
+                else if (Name == "skip-system-headers" && Value.empty())
+                        Opts.SkipSystemHeaders = true;
+                else {
+                        auto ID = Diags.getCustomDiagID(
+                                clang::DiagnosticsEngine::Error,
+                                "invalid macro-types plugin argument '%0'");
+                        Diags.Report(ID) << A;
+                        return false;
+                }
+        }
         return true;
 }
 
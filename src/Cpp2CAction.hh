@@ -1,9 +1,14 @@
 #pragma once
 
+#include "Cpp2COptions.hh"
+
 #include <clang/Frontend/FrontendPluginRegistry.h>
 
 namespace cpp2c {
 class Cpp2CAction : public clang::PluginASTAction {
+    private:
+        cpp2c::Cpp2COptions Opts;
+
     protected:
         std::unique_ptr<clang::ASTConsumer>
         CreateASTConsumer(clang::CompilerInstance &CI,
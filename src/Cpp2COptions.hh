@@ -0,0 +1,51 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace cpp2c {
+// The ways the properties of macro expansions can be computed
+enum class Engine {
+        // Finds aligned AST nodes and checks each property with AST matchers.
+        // This is the reference implementation that other engines are
+        // checked against.
+        Matcher,
+        // Checks properties with indexes built once per translation unit.
+        // Must give the same results as the matcher engine.
+        Fast,
+};
+
+// Options passed to the plugin on the command line with
+// -fplugin-arg-macro-types-<name>=<value>
+struct Cpp2COptions {
+        // The file to write results to.
+        // If empty, results are written to stdout instead.
+        std::string OutputFile;
+        // Whether to analyze and emit the macro expansions inside each
+        // top-level declaration as soon as the declaration has been parsed,
+        // instead of after parsing the entire translation unit.
+        // This bounds memory usage by the size of the largest declaration.
+        bool Incremental = false;
+        // The file to write the paths of the main file and all files it
+        // includes to, one per line.
+        // Used by the evaluation scripts to key their result cache.
+        std::string DepsFile;
+        // The file to write the time and peak memory usage of each phase of
+        // the analysis to
+        std::string StatsFile;
+        // The engine to compute the properties of macro expansions with
+        cpp2c::Engine AnalysisEngine = Engine::Matcher;
+        // The number of threads to analyze the expansions of a translation
+        // unit with, or 0 to use all hardware threads.
+        // Results are the same for any number of threads.
+        unsigned Jobs = 1;
+        // If not empty, only the macros invoked in files whose real paths
+        // begin with one of these prefixes are analyzed
+        std::vector<std::string> IncludePaths;
+        // The macros invoked in files whose real paths begin with one of
+        // these prefixes are not analyzed
+        std::vector<std::string> ExcludePaths;
+        // Whether to skip the macros invoked in system headers
+        bool SkipSystemHeaders = false;
+};
+} // namespace cpp2c
@@ -1,44 +1,54 @@
 #include "DefinitionInfoCollector.hh"
 
+#include <algorithm>
+
 namespace cpp2c {
 
-DefinitionInfoCollector::DefinitionInfoCollector(clang::ASTContext &Ctx)
-        : SM(Ctx.getSourceManager())
-        , LO(Ctx.getLangOpts()) {
+DefinitionInfoCollector::DefinitionInfoCollector(clang::ASTContext &Ctx) {
+}
+
+std::vector<llvm::StringRef>
+DefinitionInfoCollector::inspectedMacroNames() const {
+        std::vector<llvm::StringRef> Names;
+        Names.reserve(InspectedMacroNames.size());
+        for (auto II : InspectedMacroNames)
+                Names.push_back(II->getName());
+        std::sort(Names.begin(), Names.end());
+        return Names;
 }
 
 void DefinitionInfoCollector::MacroDefined(const clang::Token &MacroNameTok,
                                            const clang::MacroDirective *MD) {
-        std::string Name = clang::Lexer::getSpelling(MacroNameTok, SM, LO);
-        MacroNamesDefinitions.push_back({ Name, MD });
+        if (auto II = MacroNameTok.getIdentifierInfo())
+                MacroNamesDefinitions.push_back({ II, MD });
 }
 
 void DefinitionInfoCollector::MacroUndefined(
         const clang::Token &MacroNameTok, const clang::MacroDefinition &MD,
         const clang::MacroDirective *Undef) {
-        auto Name = clang::Lexer::getSpelling(MacroNameTok, SM, LO);
-        InspectedMacroNames.insert(Name);
+        if (auto II = MacroNameTok.getIdentifierInfo())
+                InspectedMacroNames.insert(II);
 }
 
 void DefinitionInfoCollector::Defined(const clang::Token &MacroNameTok,
                                       const clang::MacroDefinition &MD,
                                       clang::SourceRange Range) {
-        auto Name = clang::Lexer::getSpelling(MacroNameTok, SM, LO);
-        InspectedMacroNames.insert(Name);
+        if (auto II = MacroNameTok.getIdentifierInfo())
+                InspectedMacroNames.insert(II);
 }
 
 void DefinitionInfoCollector::Ifdef(clang::SourceLocation Loc,
                                     const clang::Token &MacroNameTok,
                                     const clang::MacroDefinition &MD) {
-        auto Name = clang::Lexer::getSpelling(MacroNameTok, SM, LO);
-        InspectedMacroNames.insert(Name);
+        if (auto II = MacroNameTok.getIdentifierInfo())
+                InspectedMacroNames.insert(II);
 }
 
 void DefinitionInfoCollector::Ifndef(clang::SourceLocation Loc,
                                      const clang::Token &MacroNameTok,
                                      const clang::MacroDefinition &MD) {
-        auto Name = clang::Lexer::getSpelling(MacroNameTok, SM, LO);
-        InspectedMacroNames.insert(Name);
+        if (auto II = MacroNameTok.getIdentifierInfo())
+                InspectedMacroNames.insert(II);
 }
 
 } // namespace cpp2c
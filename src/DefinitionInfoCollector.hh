@@ -1,30 +1,36 @@
 #pragma once
 
 #include "clang/AST/ASTContext.h"
+#include "clang/Basic/IdentifierTable.h"
 #include "clang/Basic/SourceLocation.h"
-#include "clang/Basic/SourceManager.h"
-#include "clang/Lex/Lexer.h"
 #include "clang/Lex/MacroInfo.h"
 #include "clang/Lex/PPCallbacks.h"
 #include "clang/Lex/Token.h"
 
-#include <set>
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/StringRef.h"
+
 #include <utility>
 #include <vector>
 
 namespace cpp2c {
+// Records the macros defined in a translation unit, and the names of macros
+// inspected by the preprocessor.
+// Macro names are recorded by their identifiers, which the preprocessor
+// interns, so no callback has to spell out the name of its macro.
 class DefinitionInfoCollector : public clang::PPCallbacks {
-    private:
-        clang::SourceManager &SM;
-        const clang::LangOptions &LO;
-
     public:
-        std::vector<std::pair<std::string, const clang::MacroDirective *> >
+        std::vector<std::pair<const clang::IdentifierInfo *,
+                              const clang::MacroDirective *> >
                 MacroNamesDefinitions;
-        std::set<std::string> InspectedMacroNames;
+        llvm::SmallPtrSet<const clang::IdentifierInfo *, 32>
+                InspectedMacroNames;
 
         DefinitionInfoCollector(clang::ASTContext &Ctx);
 
+        // Returns the names of the macros inspected so far, in sorted order
+        std::vector<llvm::StringRef> inspectedMacroNames() const;
+
         void MacroDefined(const clang::Token &MacroNameTok,
                           const clang::MacroDirective *MD) override;
 
@@ -42,4 +48,4 @@ class DefinitionInfoCollector : public clang::PPCallbacks {
         void Ifndef(clang::SourceLocation Loc, const clang::Token &MacroNameTok,
                     const clang::MacroDefinition &MD) override;
 };
-} // namespace cpp2c
\ No newline at end of file
+} // namespace cpp2c
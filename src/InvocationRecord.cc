@@ -0,0 +1,119 @@
+#include "InvocationRecord.hh"
+#include "Logging.hh"
+
+namespace cpp2c {
+// Only pretty print JSON if debug is on
+static const char sep = Debug ? '\n' : ' ';
+
+static void printEntry(llvm::raw_ostream &OS, llvm::StringRef K,
+                       llvm::StringRef V) {
+        OS << "    \"" << K << "\" : \"" << V << "\"";
+}
+
+static void printEntry(llvm::raw_ostream &OS, llvm::StringRef K, int V) {
+        OS << "    \"" << K << "\" : " << V;
+}
+
+static void printEntry(llvm::raw_ostream &OS, llvm::StringRef K, bool V) {
+        OS << "    \"" << K << "\" : " << (V ? "true" : "false");
+}
+
+void InvocationRecord::print(llvm::raw_ostream &OS) const {
+        std::pair<const char *, const std::string &> StringEntries[] = {
+                { "Name", Name },
+                { "DefinitionLocation", DefinitionLocation },
+                { "EndDefinitionLocation", EndDefinitionLocation },
+                { "InvocationLocation", InvocationLocation },
+                { "ASTKind", ASTKind },
+                { "TypeSignature", TypeSignature },
+        };
+
+        std::pair<const char *, int> IntEntries[] = {
+                { "InvocationDepth", InvocationDepth },
+                { "NumASTRoots", NumASTRoots },
+                { "NumArguments", NumArguments },
+        };
+
+        std::pair<const char *, bool> BoolEntries[] = {
+                { "HasStringification", HasStringification },
+                { "HasTokenPasting", HasTokenPasting },
+                { "HasAlignedArguments", HasAlignedArguments },
+                { "HasSameNameAsOtherDeclaration",
+                  HasSameNameAsOtherDeclaration },
+
+                { "IsExpansionControlFlowStmt", IsExpansionControlFlowStmt },
+
+                { "DoesBodyReferenceMacroDefinedAfterMacro",
+                  DoesBodyReferenceMacroDefinedAfterMacro },
+                { "DoesBodyReferenceDeclDeclaredAfterMacro",
+                  DoesBodyReferenceDeclDeclaredAfterMacro },
+                { "DoesBodyContainDeclRefExpr", DoesBodyContainDeclRefExpr },
+                { "DoesSubexpressionExpandedFromBodyHaveLocalType",
+                  DoesSubexpressionExpandedFromBodyHaveLocalType },
+                { "DoesSubexpressionExpandedFromBodyHaveTypeDefinedAfterMacro",
+                  DoesSubexpressionExpandedFromBodyHaveTypeDefinedAfterMacro },
+
+                { "DoesAnyArgumentHaveSideEffects",
+                  DoesAnyArgumentHaveSideEffects },
+                { "DoesAnyArgumentContainDeclRefExpr",
+                  DoesAnyArgumentContainDeclRefExpr },
+
+                { "IsHygienic", IsHygienic },
+                { "IsDefinitionLocationValid", IsDefinitionLocationValid },
+                { "IsInvocationLocationValid", IsInvocationLocationValid },
+                { "IsObjectLike", IsObjectLike },
+                { "IsInvokedInMacroArgument", IsInvokedInMacroArgument },
+                { "IsNamePresentInCPPConditional",
+                  IsNamePresentInCPPConditional },
+                { "IsExpansionICE", IsExpansionICE },
+
+                { "IsExpansionTypeNull", IsExpansionTypeNull },
+                { "IsExpansionTypeAnonymous", IsExpansionTypeAnonymous },
+                { "IsExpansionTypeLocalType", IsExpansionTypeLocalType },
+                { "IsExpansionTypeDefinedAfterMacro",
+                  IsExpansionTypeDefinedAfterMacro },
+                { "IsExpansionTypeVoid", IsExpansionTypeVoid },
+
+                { "IsAnyArgumentTypeNull", IsAnyArgumentTypeNull },
+                { "IsAnyArgumentTypeAnonymous", IsAnyArgumentTypeAnonymous },
+                { "IsAnyArgumentTypeLocalType", IsAnyArgumentTypeLocalType },
+                { "IsAnyArgumentTypeDefinedAfterMacro",
+                  IsAnyArgumentTypeDefinedAfterMacro },
+                { "IsAnyArgumentTypeVoid", IsAnyArgumentTypeVoid },
+
+                { "IsInvokedWhereModifiableValueRequired",
+                  IsInvokedWhereModifiableValueRequired },
+                { "IsInvokedWhereAddressableValueRequired",
+                  IsInvokedWhereAddressableValueRequired },
+                { "IsInvokedWhereICERequired", IsInvokedWhereICERequired },
+
+                { "IsAnyArgumentExpandedWhereModifiableValueRequired",
+                  IsAnyArgumentExpandedWhereModifiableValueRequired },
+                { "IsAnyArgumentExpandedWhereAddressableValueRequired",
+                  IsAnyArgumentExpandedWhereAddressableValueRequired },
+                { "IsAnyArgumentConditionallyEvaluated",
+                  IsAnyArgumentConditionallyEvaluated },
+                { "IsAnyArgumentNeverExpanded", IsAnyArgumentNeverExpanded },
+                { "IsAnyArgumentNotAnExpression",
+                  IsAnyArgumentNotAnExpression },
+        };
+
+        OS << '{' << sep << "\"PropertiesOf\" : \"Invocation\"," << sep;
+        for (auto &&E : StringEntries) {
+                printEntry(OS, E.first, llvm::StringRef(E.second));
+                OS << "," << sep;
+        }
+        for (auto &&E : IntEntries) {
+                printEntry(OS, E.first, E.second);
+                OS << "," << sep;
+        }
+        bool First = true;
+        for (auto &&E : BoolEntries) {
+                if (!First)
+                        OS << "," << sep;
+                First = false;
+                printEntry(OS, E.first, E.second);
+        }
+        OS << sep << " }\n";
+}
+} // namespace cpp2c
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "llvm/Support/raw_ostream.h"
+
+#include <string>
+
+namespace cpp2c {
+// The properties of one macro invocation that are emitted as an
+// "Invocation" result object
+struct InvocationRecord {
+        // String properties
+        std::string Name, DefinitionLocation, EndDefinitionLocation,
+                InvocationLocation, ASTKind, TypeSignature;
+
+        // Integer properties
+        int InvocationDepth = 0;
+        int NumASTRoots = 0;
+        int NumArguments = 0;
+
+        // Boolean properties
+        bool HasStringification = false;
+        bool HasTokenPasting = false;
+        bool HasAlignedArguments = false;
+        bool HasSameNameAsOtherDeclaration = false;
+        bool IsExpansionControlFlowStmt = false;
+        bool DoesBodyReferenceMacroDefinedAfterMacro = false;
+        bool DoesBodyReferenceDeclDeclaredAfterMacro = false;
+        bool DoesBodyContainDeclRefExpr = false;
+        bool DoesSubexpressionExpandedFromBodyHaveLocalType = false;
+        bool DoesSubexpressionExpandedFromBodyHaveTypeDefinedAfterMacro = false;
+        bool DoesAnyArgumentHaveSideEffects = false;
+        bool DoesAnyArgumentContainDeclRefExpr = false;
+        bool IsHygienic = false;
+        bool IsDefinitionLocationValid = false;
+        bool IsInvocationLocationValid = false;
+        bool IsObjectLike = false;
+        bool IsInvokedInMacroArgument = false;
+        bool IsNamePresentInCPPConditional = false;
+        bool IsExpansionICE = false;
+        bool IsExpansionTypeNull = false;
+        bool IsExpansionTypeAnonymous = false;
+        bool IsExpansionTypeLocalType = false;
+        bool IsExpansionTypeDefinedAfterMacro = false;
+        bool IsExpansionTypeVoid = false;
+        bool IsAnyArgumentTypeNull = false;
+        bool IsAnyArgumentTypeAnonymous = false;
+        bool IsAnyArgumentTypeLocalType = false;
+        bool IsAnyArgumentTypeDefinedAfterMacro = false;
+        bool IsAnyArgumentTypeVoid = false;
+        bool IsInvokedWhereModifiableValueRequired = false;
+        bool IsInvokedWhereAddressableValueRequired = false;
+        bool IsInvokedWhereICERequired = false;
+        bool IsAnyArgumentExpandedWhereModifiableValueRequired = false;
+        bool IsAnyArgumentExpandedWhereAddressableValueRequired = false;
+        bool IsAnyArgumentConditionallyEvaluated = false;
+        bool IsAnyArgumentNeverExpanded = false;
+        bool IsAnyArgumentNotAnExpression = false;
+
+        // Prints this record as a JSON object, followed by a newline
+        void print(llvm::raw_ostream &OS) const;
+};
+} // namespace cpp2c
@@ -0,0 +1,56 @@
+#include "LocationCache.hh"
+
+namespace cpp2c {
+LocationCache::Entry &LocationCache::resolve(clang::SourceLocation L) {
+        auto Res = Entries.try_emplace(L.getRawEncoding());
+        auto &E = Res.first->second;
+        if (Res.second) {
+                E.Spelling = SM.getSpellingLoc(L);
+                E.Expansion = SM.getExpansionLoc(L);
+                E.ImmediateCaller = SM.getImmediateMacroCallerLoc(L);
+        }
+        return E;
+}
+
+clang::SourceLocation LocationCache::getSpellingLoc(clang::SourceLocation L) {
+        return Enabled ? resolve(L).Spelling : SM.getSpellingLoc(L);
+}
+
+clang::SourceLocation
+LocationCache::getExpansionLoc(clang::SourceLocation L) {
+        return Enabled ? resolve(L).Expansion : SM.getExpansionLoc(L);
+}
+
+clang::SourceLocation
+LocationCache::getImmediateMacroCallerLoc(clang::SourceLocation L) {
+        return Enabled ? resolve(L).ImmediateCaller :
+                         SM.getImmediateMacroCallerLoc(L);
+}
+
+clang::SourceLocation
+LocationCache::getOutermostMacroCallerLoc(clang::SourceLocation L) {
+        if (!Enabled) {
+                while (SM.getImmediateMacroCallerLoc(L).isMacroID() &&
+                       SM.getImmediateMacroCallerLoc(L).isValid())
+                        L = SM.getImmediateMacroCallerLoc(L);
+                return L;
+        }
+
+        auto &E = resolve(L);
+        if (E.HasOutermostCaller)
+                return E.OutermostCaller;
+
+        // Nodes expanded from the same macro share the rest of the chain, so
+        // resolve it through the cache as well
+        auto Caller = E.ImmediateCaller;
+        auto Outermost = (Caller.isMacroID() && Caller.isValid()) ?
+                                 getOutermostMacroCallerLoc(Caller) :
+                                 L;
+
+        // Resolving the caller may have moved our entry
+        auto &Resolved = resolve(L);
+        Resolved.OutermostCaller = Outermost;
+        Resolved.HasOutermostCaller = true;
+        return Outermost;
+}
+} // namespace cpp2c
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "clang/Basic/SourceLocation.h"
+#include "clang/Basic/SourceManager.h"
+
+#include "llvm/ADT/DenseMap.h"
+
+namespace cpp2c {
+// Resolves source locations to the locations the alignment matchers compare.
+// Every AST node in the traversal scope is checked against every expansion,
+// so the same locations are resolved over and over. If enabled, the cache
+// remembers what each location resolves to, keyed by its raw encoding, so
+// that the source manager only resolves each location once per translation
+// unit. Otherwise, every query is forwarded to the source manager.
+class LocationCache {
+    private:
+        // What one location resolves to
+        struct Entry {
+                clang::SourceLocation Spelling;
+                clang::SourceLocation Expansion;
+                clang::SourceLocation ImmediateCaller;
+                // Only valid if HasOutermostCaller is set
+                clang::SourceLocation OutermostCaller;
+                bool HasOutermostCaller = false;
+        };
+
+        const clang::SourceManager &SM;
+        bool Enabled = false;
+        llvm::DenseMap<clang::SourceLocation::UIntTy, Entry> Entries;
+
+        // Returns the entry for the given location, resolving it first if
+        // it is not cached yet.
+        // The reference is invalidated when another location is resolved.
+        Entry &resolve(clang::SourceLocation L);
+
+    public:
+        LocationCache(const clang::SourceManager &SM)
+                : SM(SM) {
+        }
+
+        void setEnabled(bool E) {
+                Enabled = E;
+        }
+
+        clang::SourceLocation getSpellingLoc(clang::SourceLocation L);
+        clang::SourceLocation getExpansionLoc(clang::SourceLocation L);
+        clang::SourceLocation
+        getImmediateMacroCallerLoc(clang::SourceLocation L);
+
+        // Returns the location reached by following immediate macro callers
+        // from the given location for as long as they are macro locations
+        clang::SourceLocation
+        getOutermostMacroCallerLoc(clang::SourceLocation L);
+};
+} // namespace cpp2c
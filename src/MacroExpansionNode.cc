@@ -79,4 +79,29 @@ std::set<MacroExpansionNode *> MacroExpansionNode::getDescendants() {
         return Desc;
 }
 
+void MacroExpansionNode::summarizeDescendants(clang::SourceManager &SM) {
+        LatestDescendantDefinitionLoc = clang::SourceLocation();
+        HasDescendantWithoutDefinitionLoc = false;
+        auto Note = [this, &SM](clang::SourceLocation L) {
+                if (LatestDescendantDefinitionLoc.isInvalid() ||
+                    SM.isBeforeInTranslationUnit(LatestDescendantDefinitionLoc,
+                                                 L))
+                        LatestDescendantDefinitionLoc = L;
+        };
+
+        for (auto &&Child : Children) {
+                Child->summarizeDescendants(SM);
+                HasDescendantWithoutDefinitionLoc |=
+                        Child->HasDescendantWithoutDefinitionLoc;
+
+                auto ChildLoc = SM.getFileLoc(Child->MI->getDefinitionLoc());
+                if (ChildLoc.isValid())
+                        Note(ChildLoc);
+                else
+                        HasDescendantWithoutDefinitionLoc = true;
+                if (Child->LatestDescendantDefinitionLoc.isValid())
+                        Note(Child->LatestDescendantDefinitionLoc);
+        }
+}
+
 } // namespace cpp2c
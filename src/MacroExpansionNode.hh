@@ -4,6 +4,7 @@
 #include "MacroExpansionArgument.hh"
 
 #include "clang/AST/Stmt.h"
+#include "clang/Basic/IdentifierTable.h"
 #include "clang/Basic/SourceLocation.h"
 #include "clang/Lex/MacroInfo.h"
 
@@ -20,6 +21,9 @@ class MacroExpansionNode {
         clang::MacroInfo *MI;
         // The name of the expanded macro
         llvm::StringRef Name;
+        // The identifier of the expanded macro's name, so that looking it up
+        // does not hash the name again
+        const clang::IdentifierInfo *NameInfo = nullptr;
         // The hash of the macro this expansion is an expansion of.
         // This hash is the source location of the macro's definition.
         std::string MacroHash;
@@ -62,6 +66,20 @@ class MacroExpansionNode {
         bool HasTokenPasting = false;
         // Whether this expansion is in of an argument of another invocation
         bool InMacroArg;
+        // Whether this expansion occurred in an #if or #elif condition or in
+        // a computed #include, or is nested under one that did.
+        // No AST node contains the tokens of such an expansion.
+        bool InDirective = false;
+        // The file location of the definition of the macro expanded under
+        // this invocation that was defined last in the translation unit, or
+        // an invalid location if no macro was expanded under it.
+        // Only set by summarizeDescendants.
+        clang::SourceLocation LatestDescendantDefinitionLoc;
+        // Whether the definition of any macro expanded under this invocation
+        // has no valid file location, in which case definitions cannot be
+        // ordered by LatestDescendantDefinitionLoc alone.
+        // Only set by summarizeDescendants.
+        bool HasDescendantWithoutDefinitionLoc = false;
 
         // Destructor should only be called on top-level expansions
         ~MacroExpansionNode();
@@ -77,6 +95,11 @@ class MacroExpansionNode {
         // Does not include macros passed to this macro's invocation as
         // arguments.
         std::set<MacroExpansionNode *> getDescendants();
+
+        // Sets the summaries of the descendants of this expansion and of
+        // every expansion nested under it, bottom-up.
+        // Must be called again if any expansion is nested under it later.
+        void summarizeDescendants(clang::SourceManager &SM);
 };
 
 } // namespace cpp2c
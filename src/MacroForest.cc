@@ -9,6 +9,8 @@
 
 #include "llvm/Support/raw_ostream.h"
 
+#include <algorithm>
+
 // TODO:    Check if we should treat expansions written in scratch space
 //          differently from other expansions
 
@@ -21,15 +23,26 @@ inline clang::SourceRange getSpellingRange(clang::ASTContext &Ctx,
                                   Ctx.getFullLoc(E).getSpellingLoc());
 }
 
-MacroForest::MacroForest(clang::Preprocessor &PP, clang::ASTContext &Ctx)
+MacroForest::MacroForest(clang::Preprocessor &PP, clang::ASTContext &Ctx,
+                         cpp2c::PathFilter *Filter)
         : PP(PP)
-        , Ctx(Ctx) {
+        , Ctx(Ctx)
+        , Filter(Filter) {
 }
 
 void MacroForest::MacroExpands(const clang::Token &MacroNameTok,
                                const clang::MacroDefinition &MD,
                                clang::SourceRange Range,
                                const clang::MacroArgs *Args) {
+        // Nested expansions and expansions in arguments are expanded in the
+        // same file as their top-level expansion, so whole expansion trees
+        // are skipped, and the expansions we do record keep all of their
+        // descendants.
+        // We skip before allocating anything or pre-expanding the
+        // arguments, which the preprocessor does later if it needs them.
+        if (Filter && !Filter->shouldAnalyze(Range.getBegin()))
+                return;
+
         auto MI = MD.getMacroInfo();
         auto &SM = Ctx.getSourceManager();
         const auto &LO = Ctx.getLangOpts();
@@ -39,7 +52,8 @@ void MacroForest::MacroExpands(const clang::Token &MacroNameTok,
 
         auto Expansion = new MacroExpansionNode();
         Expansion->MI = MD.getMacroInfo();
-        Expansion->Name = MacroNameTok.getIdentifierInfo()->getName();
+        Expansion->NameInfo = MacroNameTok.getIdentifierInfo();
+        Expansion->Name = Expansion->NameInfo->getName();
         Expansion->MacroHash = MI->getDefinitionLoc().printToString(SM);
         Expansion->DefinitionRange = clang::SourceRange(
                 MI->getDefinitionLoc(), MI->getDefinitionEndLoc());
@@ -47,6 +61,9 @@ void MacroForest::MacroExpands(const clang::Token &MacroNameTok,
         Expansion->SpellingRange =
                 getSpellingRange(Ctx, Range.getBegin(), Range.getEnd());
         Expansion->InMacroArg = InMacroArg;
+        // The preprocessor only expands macros in an #if or #elif condition
+        // to evaluate it
+        Expansion->InDirective = PP.isParsingIfOrElifDirective();
 
         // Add the expansion to the forest
 
@@ -65,6 +82,7 @@ void MacroForest::MacroExpands(const clang::Token &MacroNameTok,
                 Expansion->Parent = InvocationStack.top();
                 Expansion->Parent->Children.push_back(Expansion);
                 Expansion->Depth = Expansion->Parent->Depth + 1;
+                Expansion->InDirective |= Expansion->Parent->InDirective;
         }
         Expansions.push_back(Expansion);
 
@@ -158,4 +176,71 @@ void MacroForest::MacroExpands(const clang::Token &MacroNameTok,
         }
 }
 
+void MacroForest::InclusionDirective(
+        clang::SourceLocation HashLoc, const clang::Token &IncludeTok,
+        llvm::StringRef FileName, bool IsAngled,
+        clang::CharSourceRange FilenameRange, const clang::FileEntry *File,
+        llvm::StringRef SearchPath, llvm::StringRef RelativePath,
+        const clang::Module *Imported,
+        clang::SrcMgr::CharacteristicKind FileType) {
+        auto &SM = Ctx.getSourceManager();
+
+        // This is called before the included file is entered, so the
+        // top-level expansions recorded since the last include directive
+        // that begin after this one's hash were expanded in its file name.
+        // Find the first of them, along with the expansions nested under
+        // the top-level expansion before it.
+        auto First = Expansions.size();
+        while (First > ScannedExpansions) {
+                auto Exp = Expansions[First - 1];
+                if (Exp->Depth == 0) {
+                        auto B = SM.getExpansionLoc(
+                                Exp->SpellingRange.getBegin());
+                        if (B.isInvalid() ||
+                            SM.isBeforeInTranslationUnit(B, HashLoc))
+                                break;
+                }
+                First--;
+        }
+
+        // Parents are recorded before their children
+        for (auto I = First; I < Expansions.size(); I++) {
+                auto Exp = Expansions[I];
+                Exp->InDirective |= (Exp->Depth == 0) ||
+                                    Exp->Parent->InDirective;
+        }
+        ScannedExpansions = Expansions.size();
+}
+
+void MacroForest::releaseExpansions(
+        const std::set<cpp2c::MacroExpansionNode *> &Roots) {
+        auto IsReleased = [&Roots](cpp2c::MacroExpansionNode *Exp) {
+                while (Exp->Parent)
+                        Exp = Exp->Parent;
+                return Roots.find(Exp) != Roots.end();
+        };
+
+        Expansions.erase(std::remove_if(Expansions.begin(), Expansions.end(),
+                                        IsReleased),
+                         Expansions.end());
+
+        // The invocation stack may still refer to the released expansions
+        std::vector<cpp2c::MacroExpansionNode *> Kept;
+        while (!InvocationStack.empty()) {
+                if (!IsReleased(InvocationStack.top()))
+                        Kept.push_back(InvocationStack.top());
+                InvocationStack.pop();
+        }
+        for (auto It = Kept.rbegin(); It != Kept.rend(); ++It)
+                InvocationStack.push(*It);
+
+        // The preprocessor is never in the middle of a directive between
+        // top-level declarations
+        ScannedExpansions = Expansions.size();
+
+        // Deleting a top-level expansion deletes all expansions nested under it
+        for (auto &&Root : Roots)
+                delete Root;
+}
+
 } // namespace cpp2c
@@ -1,10 +1,18 @@
 #pragma once
 
 #include "MacroExpansionNode.hh"
+#include "PathFilter.hh"
 
 #include "clang/AST/ASTContext.h"
+#include "clang/Basic/FileManager.h"
+#include "clang/Basic/Module.h"
+#include "clang/Basic/SourceManager.h"
 #include "clang/Lex/PPCallbacks.h"
+#include "clang/Lex/Token.h"
 
+#include "llvm/ADT/StringRef.h"
+
+#include <set>
 #include <stack>
 #include <vector>
 
@@ -14,21 +22,43 @@ class MacroForest : public clang::PPCallbacks {
         clang::Preprocessor &PP;
         clang::ASTContext &Ctx;
         std::vector<cpp2c::MacroExpansionNode *> Expansions;
+        // If given, only expansions in the files it accepts are recorded
+        cpp2c::PathFilter *Filter;
 
         // Whether or not the current expansion is within a macro argument
         bool InMacroArg = false;
 
+        // The number of expansions recorded when the last include directive
+        // was processed, so that none of the expansions before it has to be
+        // checked again for being in an include directive
+        size_t ScannedExpansions = 0;
+
         // The stack of previous expansions.
         // The invocations in this stack should only ever be previous
         // siblings of the current invocation, or the parent invocation
         // of the current invocation.
         std::stack<cpp2c::MacroExpansionNode *> InvocationStack;
 
-        MacroForest(clang::Preprocessor &PP, clang::ASTContext &Ctx);
+        MacroForest(clang::Preprocessor &PP, clang::ASTContext &Ctx,
+                    cpp2c::PathFilter *Filter = nullptr);
+
+        // Removes the given top-level expansions and all expansions nested
+        // under them from the forest, and frees them
+        void releaseExpansions(
+            const std::set<cpp2c::MacroExpansionNode *> &Roots);
 
         void MacroExpands(const clang::Token &MacroNameTok,
                           const clang::MacroDefinition &MD,
                           clang::SourceRange Range,
                           const clang::MacroArgs *Args) override;
+
+        // Marks the expansions in the file name of a computed include
+        void InclusionDirective(
+                clang::SourceLocation HashLoc, const clang::Token &IncludeTok,
+                llvm::StringRef FileName, bool IsAngled,
+                clang::CharSourceRange FilenameRange,
+                const clang::FileEntry *File, llvm::StringRef SearchPath,
+                llvm::StringRef RelativePath, const clang::Module *Imported,
+                clang::SrcMgr::CharacteristicKind FileType) override;
 };
 } // namespace cpp2c
@@ -0,0 +1,60 @@
+#include "PathFilter.hh"
+
+namespace cpp2c {
+PathFilter::PathFilter(const clang::SourceManager &SM,
+                       const cpp2c::Cpp2COptions &Opts)
+        : SM(SM)
+        , IncludePrefixes(Opts.IncludePaths)
+        , ExcludePrefixes(Opts.ExcludePaths)
+        , SkipSystemHeaders(Opts.SkipSystemHeaders) {
+}
+
+// Returns true if either path begins with one of the given prefixes
+static bool hasPrefix(const std::vector<std::string> &Prefixes,
+                      llvm::StringRef RealPath, llvm::StringRef Name) {
+        for (auto &&Prefix : Prefixes)
+                if ((!RealPath.empty() && RealPath.startswith(Prefix)) ||
+                    (!Name.empty() && Name.startswith(Prefix)))
+                        return true;
+        return false;
+}
+
+bool PathFilter::matches(llvm::StringRef RealPath, llvm::StringRef Name,
+                         clang::SrcMgr::CharacteristicKind Kind) const {
+        if (SkipSystemHeaders && clang::SrcMgr::isSystem(Kind))
+                return false;
+        if (hasPrefix(ExcludePrefixes, RealPath, Name))
+                return false;
+        return IncludePrefixes.empty() ||
+               hasPrefix(IncludePrefixes, RealPath, Name);
+}
+
+bool PathFilter::shouldAnalyze(clang::SourceLocation L) {
+        if (empty())
+                return true;
+
+        // Buffers that are not files, like the predefines, have no path
+        auto FID = SM.getFileID(SM.getExpansionLoc(L));
+        if (FID.isInvalid())
+                return matches("", "", clang::SrcMgr::C_User);
+
+        auto Res = Decisions.try_emplace(FID);
+        if (Res.second) {
+                auto Kind = SM.getFileCharacteristic(
+                        SM.getLocForStartOfFile(FID));
+                auto FE = SM.getFileEntryForID(FID);
+                Res.first->second = FE ? shouldAnalyze(FE, Kind) :
+                                         matches("", "", Kind);
+        }
+        return Res.first->second;
+}
+
+bool PathFilter::shouldAnalyze(const clang::FileEntry *FE,
+                               clang::SrcMgr::CharacteristicKind Kind) const {
+        if (empty())
+                return true;
+        if (!FE)
+                return matches("", "", Kind);
+        return matches(FE->tryGetRealPathName(), FE->getName(), Kind);
+}
+} // namespace cpp2c
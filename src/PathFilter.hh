@@ -0,0 +1,55 @@
+#pragma once
+
+#include "Cpp2COptions.hh"
+
+#include "clang/Basic/FileManager.h"
+#include "clang/Basic/SourceLocation.h"
+#include "clang/Basic/SourceManager.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <string>
+#include <vector>
+
+namespace cpp2c {
+// Decides which files to analyze the macros of, from the path prefixes and
+// the system header switch given on the command line.
+// A file is analyzed if it is not a system header when those are skipped,
+// and its path begins with some included prefix, if any were given, but with
+// no excluded prefix.
+// A file's path may be its real path or the path it was opened with, so that
+// prefixes may be given either way.
+// The preprocessor asks about the same few files over and over, so the
+// decision for each file is remembered.
+class PathFilter {
+    private:
+        const clang::SourceManager &SM;
+        std::vector<std::string> IncludePrefixes, ExcludePrefixes;
+        bool SkipSystemHeaders;
+        llvm::DenseMap<clang::FileID, bool> Decisions;
+
+        // Returns true if a file with the given paths and characteristic
+        // should be analyzed
+        bool matches(llvm::StringRef RealPath, llvm::StringRef Name,
+                     clang::SrcMgr::CharacteristicKind Kind) const;
+
+    public:
+        PathFilter(const clang::SourceManager &SM,
+                   const cpp2c::Cpp2COptions &Opts);
+
+        // Returns true if every file is analyzed
+        bool empty() const {
+                return IncludePrefixes.empty() && ExcludePrefixes.empty() &&
+                       !SkipSystemHeaders;
+        }
+
+        // Returns true if the file that the given location was expanded in
+        // should be analyzed
+        bool shouldAnalyze(clang::SourceLocation L);
+
+        // Returns true if the given file should be analyzed
+        bool shouldAnalyze(const clang::FileEntry *FE,
+                           clang::SrcMgr::CharacteristicKind Kind) const;
+};
+} // namespace cpp2c
@@ -0,0 +1,112 @@
+#include "PhaseTimer.hh"
+
+#include "llvm/Support/JSON.h"
+
+#include <cstdio>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+namespace cpp2c {
+// Returns the peak resident memory of this process so far, in KiB
+static long peakRSSKiB() {
+        struct rusage Usage;
+        if (getrusage(RUSAGE_SELF, &Usage) != 0)
+                return 0;
+        return Usage.ru_maxrss;
+}
+
+// Returns the current resident memory of this process in KiB, or 0 if it
+// cannot be read, e.g., on systems without /proc.
+// Phases may be entered once per expansion, so the file is only opened once.
+static long currentRSSKiB() {
+        static int FD = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+        static long PageKiB = sysconf(_SC_PAGESIZE) / 1024;
+        if (FD < 0)
+                return 0;
+        char Buf[128];
+        auto N = pread(FD, Buf, sizeof(Buf) - 1, 0);
+        if (N <= 0)
+                return 0;
+        Buf[N] = '\0';
+        // The first two fields are the total and resident sizes in pages
+        long Size, Resident;
+        if (std::sscanf(Buf, "%ld %ld", &Size, &Resident) != 2)
+                return 0;
+        return Resident * PageKiB;
+}
+
+void PhaseTimer::start(bool Enabled) {
+        this->Enabled = Enabled;
+        Current = Parse;
+        CurrentStart = Clock::now();
+        if (Enabled)
+                CurrentStartRSSKiB = currentRSSKiB();
+}
+
+void PhaseTimer::stopCurrent() {
+        auto Now = Clock::now();
+        Seconds[Current] +=
+                std::chrono::duration<double>(Now - CurrentStart).count();
+        auto RSS = currentRSSKiB();
+        RSSGrowthKiB[Current] += RSS - CurrentStartRSSKiB;
+        CurrentStart = Now;
+        CurrentStartRSSKiB = RSS;
+}
+
+void PhaseTimer::enter(Phase P) {
+        if (!Enabled || P == Current)
+                return;
+        stopCurrent();
+        Current = P;
+}
+
+void PhaseTimer::print(llvm::raw_ostream &OS, unsigned NumExpansions,
+                       unsigned NumDefinitionCacheHits) {
+        if (!Enabled)
+                return;
+        // Account for the time spent in the current phase so far
+        stopCurrent();
+
+        llvm::json::OStream J(OS, 2);
+        J.object([&] {
+                J.attribute("NumExpansions", NumExpansions);
+                J.attribute("DefinitionCacheHits", NumDefinitionCacheHits);
+                J.attribute("DefinitionCacheHitRate",
+                            NumExpansions ?
+                                    double(NumDefinitionCacheHits) /
+                                            NumExpansions :
+                                    0.0);
+                J.attribute("PeakRSSKiB", int64_t(peakRSSKiB()));
+                J.attributeArray("Phases", [&] {
+                        for (int P = 0; P < NumPhases; P++)
+                                J.object([&] {
+                                        J.attribute("Name",
+                                                    name(Phase(P)));
+                                        J.attribute("Seconds", Seconds[P]);
+                                        J.attribute("RSSGrowthKiB",
+                                                    int64_t(RSSGrowthKiB[P]));
+                                });
+                });
+        });
+        OS << "\n";
+}
+
+const char *PhaseTimer::name(Phase P) {
+        switch (P) {
+        case Parse:
+                return "Parse";
+        case Collect:
+                return "Collect";
+        case Align:
+                return "Align";
+        case Properties:
+                return "Properties";
+        case Emit:
+                return "Emit";
+        default:
+                return "Unknown";
+        }
+}
+} // namespace cpp2c
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "llvm/Support/raw_ostream.h"
+
+#include <chrono>
+
+namespace cpp2c {
+// Measures the wall-clock time spent in, and the growth of resident memory
+// during, each phase of the analysis, and the peak memory usage of the process.
+// The timer is always in exactly one phase; entering a phase leaves the
+// previous one.
+class PhaseTimer {
+    public:
+        enum Phase {
+                // Clang parsing the translation unit
+                Parse,
+                // Collecting declarations and AST nodes of interest
+                Collect,
+                // Aligning macro expansions with AST nodes
+                Align,
+                // Computing the properties of macro expansions
+                Properties,
+                // Printing results
+                Emit,
+                NumPhases
+        };
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        bool Enabled = false;
+        Phase Current = Parse;
+        Clock::time_point CurrentStart;
+        // The resident memory when the current phase was entered or last
+        // stopped
+        long CurrentStartRSSKiB = 0;
+        double Seconds[NumPhases] = {};
+        // How much resident memory grew in total during each phase.
+        // This is negative if a phase freed more than it allocated.
+        long RSSGrowthKiB[NumPhases] = {};
+
+        // Adds the time spent in, and the memory growth of, the current phase
+        // since it was entered or last stopped
+        void stopCurrent();
+
+    public:
+        // Starts timing the parse phase.
+        // If Enabled is false, all other methods do nothing.
+        void start(bool Enabled);
+
+        // Leaves the current phase and enters the given one
+        void enter(Phase P);
+
+        // Prints the time and memory growth of each phase and the peak memory
+        // of the process as a JSON object, along with the number of
+        // expansions analyzed and how many of them reused the properties of
+        // an earlier expansion of the same macro
+        void print(llvm::raw_ostream &OS, unsigned NumExpansions,
+                   unsigned NumDefinitionCacheHits);
+
+        static const char *name(Phase P);
+};
+} // namespace cpp2c
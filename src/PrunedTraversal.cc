@@ -0,0 +1,80 @@
+#include "PrunedTraversal.hh"
+
+#include <algorithm>
+
+namespace cpp2c {
+void MacroRegions::build(
+        const clang::SourceManager &SM,
+        const std::vector<cpp2c::MacroExpansionNode *> &Expansions,
+        const std::vector<std::pair<const clang::FileEntry *,
+                                    clang::SourceLocation> > &Includes) {
+        this->SM = &SM;
+        Regions.clear();
+        MaxEnds.clear();
+        SkipNothing = false;
+
+        // Every expansion is nested under or in an argument of a top-level
+        // one, so the ranges top-level expansions were invoked in contain
+        // all expanded tokens.
+        // Expansions in directives expanded to no node's tokens, so they do
+        // not need a region.
+        for (auto &&Exp : Expansions) {
+                if (Exp->Depth != 0 || Exp->InDirective)
+                        continue;
+                auto B = SM.getExpansionLoc(Exp->SpellingRange.getBegin());
+                auto E = SM.getExpansionLoc(Exp->SpellingRange.getEnd());
+                if (B.isInvalid() || E.isInvalid() ||
+                    E.getRawEncoding() < B.getRawEncoding()) {
+                        SkipNothing = true;
+                        return;
+                }
+                Regions.push_back({ B.getRawEncoding(), E.getRawEncoding() });
+        }
+
+        // The nodes of an included file are not in the offset range of the
+        // file including it, so never skip a node that encloses an include
+        for (auto &&Include : Includes) {
+                auto L = Include.second;
+                if (L.isInvalid())
+                        continue;
+                L = SM.getExpansionLoc(L);
+                Regions.push_back({ L.getRawEncoding(), L.getRawEncoding() });
+        }
+
+        std::sort(Regions.begin(), Regions.end());
+        Offset MaxEnd = 0;
+        for (auto &&R : Regions) {
+                MaxEnd = std::max(MaxEnd, R.second);
+                MaxEnds.push_back(MaxEnd);
+        }
+}
+
+bool MacroRegions::mayContainExpansion(clang::SourceLocation B,
+                                       clang::SourceLocation E) const {
+        if (SkipNothing)
+                return true;
+
+        // Nodes that begin or end with an expanded token are never skipped
+        if (B.isInvalid() || E.isInvalid() || B.isMacroID() || E.isMacroID())
+                return true;
+
+        // Offsets are only comparable within the same file
+        if (SM->getFileID(B) != SM->getFileID(E))
+                return true;
+
+        auto BO = B.getRawEncoding(), EO = E.getRawEncoding();
+        if (EO < BO)
+                return true;
+
+        // Find the regions that begin before the node ends, and check
+        // whether any of them ends after the node begins
+        auto It = std::upper_bound(
+                Regions.begin(), Regions.end(), EO,
+                [](Offset O, const std::pair<Offset, Offset> &R) {
+                        return O < R.first;
+                });
+        if (It == Regions.begin())
+                return false;
+        return MaxEnds[It - Regions.begin() - 1] >= BO;
+}
+} // namespace cpp2c
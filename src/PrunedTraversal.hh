@@ -0,0 +1,115 @@
+#pragma once
+
+#include "MacroExpansionNode.hh"
+
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "clang/Basic/FileManager.h"
+#include "clang/Basic/SourceLocation.h"
+#include "clang/Basic/SourceManager.h"
+
+#include <utility>
+#include <vector>
+
+namespace cpp2c {
+// The regions of the source files that macros were invoked in, and that
+// files were included in.
+// An AST node that begins and ends at file locations, and whose range does
+// not overlap any region, contains no tokens that a macro expanded to.
+// Traversals that look for nodes expanded from macros may skip such a node
+// along with its subtree.
+class MacroRegions {
+    private:
+        using Offset = clang::SourceLocation::UIntTy;
+
+        const clang::SourceManager *SM = nullptr;
+        // The offsets of the first and last tokens of each region, sorted by
+        // the first
+        std::vector<std::pair<Offset, Offset> > Regions;
+        // The greatest offset any region up to and including each one ends
+        // at
+        std::vector<Offset> MaxEnds;
+        // Set if we could not find the region of some expansion, in which
+        // case no node may be skipped
+        bool SkipNothing = true;
+
+    public:
+        // Finds the regions of the given top-level expansions and include
+        // directives
+        void build(const clang::SourceManager &SM,
+                   const std::vector<cpp2c::MacroExpansionNode *> &Expansions,
+                   const std::vector<std::pair<const clang::FileEntry *,
+                                               clang::SourceLocation> >
+                           &Includes);
+
+        // Returns false if the range from B to E cannot contain a token that
+        // a macro expanded to
+        bool mayContainExpansion(clang::SourceLocation B,
+                                 clang::SourceLocation E) const;
+
+        template <typename NodeType>
+        bool mayContainExpansion(const NodeType &Node) const {
+                return mayContainExpansion(Node.getBeginLoc(),
+                                           Node.getEndLoc());
+        }
+};
+
+// Traverses the Stmts, Decls, and TypeLocs in the current traversal scope in
+// the same order that a MatchFinder matches them, but skips the subtrees of
+// nodes that cannot contain a token that a macro expanded to.
+// Calls the given handler on every node it does not skip.
+template <typename Handler>
+class PrunedTraversal
+        : public clang::RecursiveASTVisitor<PrunedTraversal<Handler> > {
+    private:
+        using Base = clang::RecursiveASTVisitor<PrunedTraversal<Handler> >;
+
+        const cpp2c::MacroRegions &Regions;
+        Handler &H;
+
+    public:
+        PrunedTraversal(const cpp2c::MacroRegions &Regions, Handler &H)
+                : Regions(Regions), H(H) {
+        }
+
+        bool shouldVisitTemplateInstantiations() const {
+                return true;
+        }
+
+        bool shouldVisitImplicitCode() const {
+                return true;
+        }
+
+        bool TraverseDecl(clang::Decl *D) {
+                if (!D || !Regions.mayContainExpansion(*D))
+                        return true;
+                H(*D);
+                return Base::TraverseDecl(D);
+        }
+
+        // Takes the same arguments as the base function, so that Stmts are
+        // traversed with a work list in the same order as in a MatchFinder
+        bool TraverseStmt(clang::Stmt *ST,
+                          typename Base::DataRecursionQueue *Queue = nullptr) {
+                if (!ST || !Regions.mayContainExpansion(*ST))
+                        return true;
+                H(*ST);
+                return Base::TraverseStmt(ST, Queue);
+        }
+
+        bool TraverseTypeLoc(clang::TypeLoc TL) {
+                if (TL.isNull() || !Regions.mayContainExpansion(TL))
+                        return true;
+                H(TL);
+                return Base::TraverseTypeLoc(TL);
+        }
+};
+
+// Calls the given handler on every node in the current traversal scope of the
+// given context that may contain a token that a macro expanded to
+template <typename Handler>
+void traversePruned(clang::ASTContext &Ctx, const cpp2c::MacroRegions &Regions,
+                    Handler &H) {
+        PrunedTraversal<Handler>(Regions, H).TraverseAST(Ctx);
+}
+} // namespace cpp2c
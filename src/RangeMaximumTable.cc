@@ -0,0 +1,32 @@
+#include "RangeMaximumTable.hh"
+
+#include "llvm/Support/MathExtras.h"
+
+#include <algorithm>
+
+namespace cpp2c {
+void RangeMaximumTable::build(std::vector<unsigned> Values) {
+        Levels.clear();
+        auto N = Values.size();
+        Levels.push_back(std::move(Values));
+        for (size_t Len = 2; Len <= N; Len *= 2) {
+                auto &Prev = Levels.back();
+                std::vector<unsigned> Level(N - Len + 1);
+                for (size_t I = 0; I < Level.size(); I++)
+                        Level[I] = std::max(Prev[I], Prev[I + Len / 2]);
+                Levels.push_back(std::move(Level));
+        }
+}
+
+void RangeMaximumTable::clear() {
+        Levels = {};
+}
+
+unsigned RangeMaximumTable::max(unsigned First, unsigned Last) const {
+        if (Last <= First)
+                return 0;
+        auto K = llvm::Log2_32(Last - First);
+        auto &Level = Levels[K];
+        return std::max(Level[First], Level[Last - (1U << K)]);
+}
+} // namespace cpp2c
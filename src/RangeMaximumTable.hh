@@ -0,0 +1,32 @@
+#pragma once
+
+#include <utility>
+#include <vector>
+
+namespace cpp2c {
+// A sparse table of the maxima of all ranges of a sequence of values whose
+// lengths are powers of two.
+// Any range is covered by two such ranges, so finding its maximum takes
+// constant time, after building the table in O(n log n) time and space.
+class RangeMaximumTable {
+    private:
+        // The maxima of the ranges of length 2^k starting at each index, for
+        // each k
+        std::vector<std::vector<unsigned> > Levels;
+
+    public:
+        // Builds the table for the given values, replacing its contents
+        void build(std::vector<unsigned> Values);
+
+        // Frees the contents of the table
+        void clear();
+
+        // Returns the maximum of the values from First up to, but not
+        // including, Last, or 0 if the range is empty
+        unsigned max(unsigned First, unsigned Last) const;
+
+        unsigned max(std::pair<unsigned, unsigned> Range) const {
+                return max(Range.first, Range.second);
+        }
+};
+} // namespace cpp2c
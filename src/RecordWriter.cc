@@ -0,0 +1,102 @@
+#include "RecordWriter.hh"
+
+#include <algorithm>
+#include <chrono>
+
+namespace cpp2c {
+// Waits a little longer each time it is called, so that waiting threads spin
+// briefly at first and then sleep instead of burning a core
+class Backoff {
+    private:
+        unsigned N = 0;
+
+    public:
+        void wait() {
+                if (N < 64)
+                        std::this_thread::yield();
+                else
+                        std::this_thread::sleep_for(std::chrono::microseconds(
+                                std::min(1u << std::min(N - 64, 10u), 1000u)));
+                N++;
+        }
+};
+
+RecordWriter::RecordWriter(llvm::raw_ostream &OS)
+        : OS(OS), Slots(new Slot[Capacity]), Head(0), Tail(0),
+          FlushRequested(false), Done(false) {
+        Buffer.reserve(BufferSize);
+        Thread = std::thread([this] { run(); });
+}
+
+void RecordWriter::push(char LeadingComma,
+                        const cpp2c::InvocationRecord &Record) {
+        auto H = Head.load(std::memory_order_relaxed);
+        Backoff B;
+        while (H - Tail.load(std::memory_order_acquire) == Capacity)
+                B.wait();
+
+        auto &S = Slots[H % Capacity];
+        S.LeadingComma = LeadingComma;
+        S.Record = Record;
+        Head.store(H + 1, std::memory_order_release);
+}
+
+void RecordWriter::drain() {
+        if (!Thread.joinable())
+                return;
+        FlushRequested.store(true, std::memory_order_release);
+        Backoff B;
+        while (FlushRequested.load(std::memory_order_acquire))
+                B.wait();
+}
+
+void RecordWriter::finish() {
+        if (!Thread.joinable())
+                return;
+        Done.store(true, std::memory_order_release);
+        Thread.join();
+}
+
+RecordWriter::~RecordWriter() {
+        finish();
+}
+
+void RecordWriter::writeBuffer() {
+        OS.write(Buffer.data(), Buffer.size());
+        Buffer.clear();
+}
+
+void RecordWriter::run() {
+        llvm::raw_string_ostream BufferOS(Buffer);
+        Backoff B;
+        while (true) {
+                auto T = Tail.load(std::memory_order_relaxed);
+                if (T != Head.load(std::memory_order_acquire)) {
+                        // Format the record and release its slot
+                        auto &S = Slots[T % Capacity];
+                        BufferOS << S.LeadingComma;
+                        S.Record.print(BufferOS);
+                        Tail.store(T + 1, std::memory_order_release);
+                        if (Buffer.size() >= BufferSize)
+                                writeBuffer();
+                        B = Backoff();
+                        continue;
+                }
+
+                // The ring buffer is empty. Check Done before flushing, so
+                // that no record pushed before Done was set is missed.
+                bool Finished = Done.load(std::memory_order_acquire);
+                if (Finished || FlushRequested.load(std::memory_order_acquire)) {
+                        if (Tail.load(std::memory_order_relaxed) !=
+                            Head.load(std::memory_order_acquire))
+                                continue;
+                        writeBuffer();
+                        FlushRequested.store(false, std::memory_order_release);
+                        if (Finished)
+                                return;
+                        continue;
+                }
+                B.wait();
+        }
+}
+} // namespace cpp2c
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "InvocationRecord.hh"
+
+#include "llvm/Support/raw_ostream.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+
+namespace cpp2c {
+// Formats invocation records and writes them to a stream on a background
+// thread, so that analyzing expansions overlaps with formatting and writing
+// their results.
+// Records are handed to the writer through a bounded single-producer,
+// single-consumer ring buffer. Only one thread may push records, and it may
+// only write to the stream itself after calling drain().
+class RecordWriter {
+    private:
+        // A record waiting to be written, and the character to print before
+        // it to separate it from the previous result object.
+        // Records are copied into their slots, and slots are never cleared,
+        // so once the ring has been around a few times the strings of a
+        // record fit in the memory its slot already holds.
+        struct Slot {
+                char LeadingComma;
+                cpp2c::InvocationRecord Record;
+        };
+
+        // Number of records the ring buffer holds
+        static const constexpr size_t Capacity = 1024;
+        // Size the writer's buffer grows to before it is written to the
+        // stream
+        static const constexpr size_t BufferSize = 1 << 20;
+
+        llvm::raw_ostream &OS;
+        std::unique_ptr<Slot[]> Slots;
+        // The number of records pushed so far; only written by the producer
+        std::atomic<size_t> Head;
+        // The number of records written so far; only written by the writer
+        std::atomic<size_t> Tail;
+        // Set by the producer to ask the writer to write out everything it
+        // has, and cleared by the writer once it has
+        std::atomic<bool> FlushRequested;
+        // Set by the producer once no more records will be pushed
+        std::atomic<bool> Done;
+        std::thread Thread;
+
+        // Formatted records that have not been written to the stream yet.
+        // Only used by the writer thread.
+        std::string Buffer;
+
+        void run();
+        void writeBuffer();
+
+    public:
+        RecordWriter(llvm::raw_ostream &OS);
+
+        // Adds a copy of a record to be written after the given leading
+        // character.
+        // Blocks while the ring buffer is full.
+        void push(char LeadingComma, const cpp2c::InvocationRecord &Record);
+
+        // Waits until every record pushed so far has been written to the
+        // stream
+        void drain();
+
+        // Writes all pushed records and stops the writer thread
+        void finish();
+
+        ~RecordWriter();
+};
+} // namespace cpp2c
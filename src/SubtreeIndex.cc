@@ -0,0 +1,79 @@
+#include "SubtreeIndex.hh"
+
+#include "llvm/ADT/SmallVector.h"
+
+#include <numeric>
+
+namespace cpp2c {
+void SubtreeIndex::addRoot(const clang::Stmt *Root) {
+        if (!Root || Intervals.count(Root))
+                return;
+
+        bool Overlaps = false;
+        // Each Stmt is pushed once before the Stmts under it are numbered,
+        // and once after
+        std::vector<std::pair<const clang::Stmt *, bool> > Stack = {
+                { Root, false }
+        };
+        while (!Stack.empty()) {
+                auto Cur = Stack.back().first;
+                auto ChildrenDone = Stack.back().second;
+                Stack.pop_back();
+                if (ChildrenDone) {
+                        Intervals[Cur].second = Nodes.size();
+                        continue;
+                }
+                if (Intervals.count(Cur)) {
+                        Overlaps = true;
+                        continue;
+                }
+                Intervals[Cur] = Interval(Nodes.size(), Nodes.size());
+                Nodes.push_back(Cur);
+                Stack.push_back({ Cur, true });
+
+                // Push the children in reverse so that they are numbered in
+                // order
+                llvm::SmallVector<const clang::Stmt *, 4> Children;
+                for (auto &&Child : Cur->children())
+                        if (Child)
+                                Children.push_back(Child);
+                for (auto It = Children.rbegin(); It != Children.rend(); ++It)
+                        Stack.push_back({ *It, false });
+        }
+        Whole.resize(Nodes.size(), !Overlaps);
+}
+
+void SubtreeIndex::addLabel(unsigned Label, const clang::Stmt *ST) {
+        auto It = Intervals.find(ST);
+        if (It == Intervals.end())
+                return;
+        if (Label >= Prefixes.size())
+                Prefixes.resize(Label + 1);
+        auto &Prefix = Prefixes[Label];
+        Prefix.resize(Nodes.size() + 1);
+        // Counts are shifted by one so that finish can sum them in place
+        Prefix[It->second.first + 1]++;
+}
+
+void SubtreeIndex::finish() {
+        for (auto &&Prefix : Prefixes) {
+                Prefix.resize(Nodes.size() + 1);
+                std::partial_sum(Prefix.begin(), Prefix.end(), Prefix.begin());
+        }
+}
+
+void SubtreeIndex::clear() {
+        Nodes = {};
+        Intervals.shrink_and_clear();
+        Whole = {};
+        Prefixes = {};
+}
+
+bool SubtreeIndex::intervalOf(const clang::Stmt *ST, Interval &I) const {
+        auto It = Intervals.find(ST);
+        if (It == Intervals.end() || !Whole[It->second.first])
+                return false;
+        I = It->second;
+        return true;
+}
+} // namespace cpp2c
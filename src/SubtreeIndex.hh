@@ -0,0 +1,81 @@
+#pragma once
+
+#include "clang/AST/Stmt.h"
+
+#include "llvm/ADT/DenseMap.h"
+
+#include <utility>
+#include <vector>
+
+namespace cpp2c {
+// Numbers the Stmts under a set of roots in preorder, following
+// clang::Stmt::children(), so that the Stmts under any numbered Stmt have
+// consecutive numbers.
+// Stmts can be given labels, and the number of Stmts with a label under any
+// numbered Stmt is the difference of two prefix counts. Properties that ask
+// whether a subtree contains a Stmt of some kind then take constant time,
+// however large the translation unit is.
+class SubtreeIndex {
+    public:
+        // The numbers from first up to, but not including, second
+        using Interval = std::pair<unsigned, unsigned>;
+
+    private:
+        // The Stmt with each number
+        std::vector<const clang::Stmt *> Nodes;
+        // The numbers of the Stmts under each numbered Stmt, including it
+        llvm::DenseMap<const clang::Stmt *, Interval> Intervals;
+        // Whether each number was given while numbering a subtree that did
+        // not overlap one numbered before, i.e., whether the intervals of
+        // the Stmts with this number are complete
+        std::vector<bool> Whole;
+        // For each label, the number of Stmts with that label numbered before
+        // each number. Only counts for single Stmts until finish is called.
+        std::vector<std::vector<unsigned> > Prefixes;
+
+    public:
+        // Numbers the Stmts under the given root, if it was not numbered yet.
+        // If its subtree shares Stmts with a subtree numbered before, the
+        // intervals of all Stmts numbered here are incomplete and never
+        // returned.
+        void addRoot(const clang::Stmt *Root);
+
+        // Gives the given Stmt the given label, if it was numbered.
+        // Must be called after all roots were added.
+        void addLabel(unsigned Label, const clang::Stmt *ST);
+
+        // Turns the counts of labels into prefix counts.
+        // Must be called after all labels were added, and before any counts
+        // are queried.
+        void finish();
+
+        // Frees the contents of the index
+        void clear();
+
+        // Sets I to the numbers of the Stmts under the given Stmt, and
+        // returns true, if they were all numbered together
+        bool intervalOf(const clang::Stmt *ST, Interval &I) const;
+
+        size_t size() const {
+                return Nodes.size();
+        }
+
+        const clang::Stmt *node(unsigned N) const {
+                return Nodes[N];
+        }
+
+        // Returns the number of Stmts in the given interval with the given
+        // label
+        unsigned count(unsigned Label, Interval I) const {
+                if (Label >= Prefixes.size())
+                        return 0;
+                auto &Prefix = Prefixes[Label];
+                return Prefix[I.second] - Prefix[I.first];
+        }
+
+        // Returns whether the Stmt with the given number has the given label
+        bool has(unsigned Label, unsigned N) const {
+                return count(Label, Interval(N, N + 1)) != 0;
+        }
+};
+} // namespace cpp2c
@@ -0,0 +1,14 @@
+// RUN: rm -f %t.deps
+// RUN: cpp2c -fplugin-arg-macro-types-deps=%t.deps %s > /dev/null
+// RUN: FileCheck %s --color < %t.deps
+
+#include "one.h"
+#include "one.h"
+int main(int argc, char const *argv[])
+{
+    return ONE;
+}
+
+// CHECK: {{.*}}/Tests/deps_file.c
+// CHECK-NEXT: {{.*}}/Tests/one.h
+// CHECK-NOT: one.h
@@ -0,0 +1,11 @@
+// RUN: cpp2c-engine-diff %s -- -iquote %S | FileCheck %s --implicit-check-not=PropertiesOf --color
+
+#define ADD(a, b) ((a) + (b))
+#define ONE 1
+
+int x = ADD(ONE, ADD(ONE, 2));
+
+// The tool only prints its report, and the plugin does not also print the
+// results of analyzing the file
+// CHECK: engine_diff_output.c: {{[0-9]+}} records, 0 differences
+// CHECK-NEXT: 1 translation units, 0 differences
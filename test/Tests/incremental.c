@@ -0,0 +1,33 @@
+// RUN: cpp2c %s | jq '[.[] | select(.IsDefinitionLocationValid == null or .IsDefinitionLocationValid == true)] | sort_by(.PropertiesOf, .DefinitionLocation, .InvocationLocation)' > %t.full.json
+// RUN: cpp2c -fplugin-arg-macro-types-incremental %s | jq '[.[] | select(.IsDefinitionLocationValid == null or .IsDefinitionLocationValid == true)] | sort_by(.PropertiesOf, .DefinitionLocation, .InvocationLocation)' > %t.incremental.json
+// RUN: diff %t.full.json %t.incremental.json
+// RUN: FileCheck %s --color < %t.incremental.json
+
+#define ONE 1
+#define ADD(a, b) ((a) + (b))
+#define DECL_X int x = ONE;
+
+int global = ONE;
+
+DECL_X
+
+int f(int y)
+{
+    return ADD(y, ONE);
+}
+
+int main(int argc, char const *argv[])
+{
+    int z = ADD(f(ONE), global);
+    return z - x;
+}
+
+// CHECK: "PropertiesOf": "Invocation",
+// CHECK: "Name": "ONE",
+// CHECK: "InvocationLocation": "{{.*}}/Tests/incremental.c:10:14",
+// CHECK: "PropertiesOf": "Invocation",
+// CHECK: "Name": "ADD",
+// CHECK: "InvocationLocation": "{{.*}}/Tests/incremental.c:16:12",
+// CHECK: "PropertiesOf": "Invocation",
+// CHECK: "Name": "ADD",
+// CHECK: "InvocationLocation": "{{.*}}/Tests/incremental.c:21:13",
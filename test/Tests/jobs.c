@@ -0,0 +1,32 @@
+// RUN: cpp2c %s > %t.sequential.json
+// RUN: cpp2c -fplugin-arg-macro-types-jobs=4 %s > %t.parallel.json
+// RUN: diff %t.sequential.json %t.parallel.json
+// RUN: jq '[.[] | select(.PropertiesOf == "Invocation" and .InvocationDepth == 0)] | sort_by(.InvocationLocation)' < %t.parallel.json | FileCheck %s --color
+
+#define ONE 1
+#define ADD(a, b) ((a) + (b))
+#define INC(x) ((x)++)
+#define ADDR(x) (&(x))
+#define COND(c, a, b) ((c) ? (a) : (b))
+
+int f(int y)
+{
+    int z = ADD(y, ONE);
+    INC(z);
+    int *p = ADDR(z);
+    return COND(y, *p, ADD(z, ONE));
+}
+
+// CHECK: "Name": "ADD",
+// CHECK: "InvocationLocation": "{{.*}}jobs.c:14:13",
+// CHECK: "DoesAnyArgumentContainDeclRefExpr": true,
+// CHECK: "Name": "INC",
+// CHECK: "InvocationLocation": "{{.*}}jobs.c:15:5",
+// CHECK: "DoesAnyArgumentHaveSideEffects": false,
+// CHECK: "IsAnyArgumentExpandedWhereModifiableValueRequired": true,
+// CHECK: "Name": "ADDR",
+// CHECK: "InvocationLocation": "{{.*}}jobs.c:16:14",
+// CHECK: "IsAnyArgumentExpandedWhereAddressableValueRequired": true,
+// CHECK: "Name": "COND",
+// CHECK: "InvocationLocation": "{{.*}}jobs.c:17:12",
+// CHECK: "IsAnyArgumentConditionallyEvaluated": true,
@@ -0,0 +1,26 @@
+// RUN: rm -f %t.json
+// RUN: cpp2c -fplugin-arg-macro-types-output=%t.json %s | FileCheck %s --check-prefix=STDOUT --allow-empty
+// RUN: jq '[.[] | select(.IsDefinitionLocationValid == null or .IsDefinitionLocationValid == true)] | sort_by(.PropertiesOf, .DefinitionLocation, .InvocationLocation)' %t.json | FileCheck %s --color
+
+#define ONE 1
+#undef ONE
+int main(int argc, char const *argv[])
+{
+    return 0;
+}
+
+// STDOUT-NOT: PropertiesOf
+
+// CHECK: [
+// CHECK:   {
+// CHECK:     "PropertiesOf": "Definition",
+// CHECK:     "Name": "ONE",
+// CHECK:     "IsObjectLike": true,
+// CHECK:     "IsDefinitionLocationValid": true,
+// CHECK:     "DefinitionLocation": "{{.*}}/Tests/output_file.c:5:9"
+// CHECK:   },
+// CHECK:   {
+// CHECK:     "PropertiesOf": "InspectedByCPP",
+// CHECK:     "Name": "ONE"
+// CHECK:   }
+// CHECK: ]
@@ -0,0 +1,15 @@
+// RUN: cpp2c -fplugin-arg-macro-types-exclude-path=%S/eight.h %s | jq -c '[.[] | select(.IsDefinitionLocationValid == null or .IsDefinitionLocationValid == true) | [.PropertiesOf, .Name]]' | FileCheck %s --check-prefix=EXCLUDE --color
+// RUN: cpp2c -fplugin-arg-macro-types-include-path=%S/eight.h %s | jq -c '[.[] | [.PropertiesOf, .Name]]' | FileCheck %s --check-prefix=INCLUDE --color
+
+#include "eight.h"
+
+#define TWO 2
+
+int x = EIGHT + TWO;
+
+// Macros defined in excluded files are not printed, but their invocations in
+// analyzed files are
+// EXCLUDE: [["Definition","TWO"],["Include",null],["Invocation","EIGHT"],["Invocation","TWO"]]
+
+// Nothing in the main file is analyzed, not even the predefined macros
+// INCLUDE: [["Definition","EIGHT"]]
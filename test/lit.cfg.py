@@ -55,6 +55,10 @@ tools = [
         " -iquote ./Tests/"
         " -fsyntax-only"
     ),
+    ToolSubst(
+        "cpp2c-engine-diff",
+        f"{config.cpp2c_tools_dir}/cpp2c-engine-diff"
+    ),
     ToolSubst("FileCheck", config.file_check_path),
 ]
 
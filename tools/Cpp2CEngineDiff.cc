@@ -0,0 +1,323 @@
+// A differential checker for cpp2c's analysis engines.
+//
+// Parses each given translation unit once, and analyzes it with two instances
+// of the cpp2c AST consumer in the same process: one using the matcher engine,
+// which is the reference implementation, and one using the fast engine.
+// The records each engine emits are sorted canonically, and the records with
+// the same key are matched up. Every record that only one engine emitted, and
+// every field whose value differs between the engines, is printed along with
+// its location.
+//
+// Usage is the same as for other Clang tools:
+//
+//     cpp2c-engine-diff -p <build dir> [<file> ...]
+//     cpp2c-engine-diff <file> ... -- <compiler arguments>
+//
+// The exit status is 0 if both engines agree on every translation unit, and
+// 1 otherwise.
+
+#include "Cpp2CASTConsumer.hh"
+#include "Cpp2COptions.hh"
+
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/FrontendAction.h"
+#include "clang/Frontend/MultiplexConsumer.h"
+#include "clang/Tooling/ArgumentsAdjusters.h"
+#include "clang/Tooling/CommonOptionsParser.h"
+#include "clang/Tooling/Tooling.h"
+
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <list>
+#include <memory>
+#include <set>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace cpp2c {
+static llvm::cl::OptionCategory EngineDiffCategory("cpp2c-engine-diff options");
+
+static llvm::cl::opt<bool> Incremental(
+        "incremental",
+        llvm::cl::desc("Run both engines in incremental mode"),
+        llvm::cl::cat(EngineDiffCategory));
+
+static llvm::cl::opt<unsigned>
+        Jobs("jobs",
+             llvm::cl::desc("Number of threads the fast engine analyzes "
+                            "expansions with (0 for all hardware threads)"),
+             llvm::cl::init(1), llvm::cl::cat(EngineDiffCategory));
+
+static llvm::cl::opt<unsigned> MaxDiffs(
+        "max-diffs",
+        llvm::cl::desc("Maximum number of differences to print per "
+                       "translation unit (0 for no limit)"),
+        llvm::cl::init(50), llvm::cl::cat(EngineDiffCategory));
+
+// The results each engine emitted for one translation unit
+struct EngineOutputs {
+        std::string File;
+        std::string Matcher;
+        std::string Fast;
+};
+
+// Analyzes a translation unit with both engines, writing their results to
+// the given outputs
+class EngineDiffAction : public clang::ASTFrontendAction {
+    private:
+        EngineOutputs &Outputs;
+        llvm::raw_string_ostream MatcherOS;
+        llvm::raw_string_ostream FastOS;
+
+    public:
+        EngineDiffAction(EngineOutputs &Outputs)
+                : Outputs(Outputs), MatcherOS(Outputs.Matcher),
+                  FastOS(Outputs.Fast) {
+        }
+
+        std::unique_ptr<clang::ASTConsumer>
+        CreateASTConsumer(clang::CompilerInstance &CI,
+                          llvm::StringRef InFile) override {
+                Outputs.File = InFile.str();
+
+                cpp2c::Cpp2COptions Opts;
+                Opts.Incremental = Incremental;
+                std::vector<std::unique_ptr<clang::ASTConsumer> > Consumers;
+                Opts.AnalysisEngine = Engine::Matcher;
+                Consumers.push_back(std::make_unique<cpp2c::Cpp2CASTConsumer>(
+                        CI, Opts, &MatcherOS));
+                Opts.AnalysisEngine = Engine::Fast;
+                Opts.Jobs = Jobs;
+                Consumers.push_back(std::make_unique<cpp2c::Cpp2CASTConsumer>(
+                        CI, Opts, &FastOS));
+                return std::make_unique<clang::MultiplexConsumer>(
+                        std::move(Consumers));
+        }
+
+        void EndSourceFileAction() override {
+                MatcherOS.flush();
+                FastOS.flush();
+        }
+};
+
+// Creates an action for each compile command the tool runs, and keeps the
+// outputs of all of them
+class EngineDiffActionFactory
+        : public clang::tooling::FrontendActionFactory {
+    public:
+        // A list so that adding outputs does not move earlier ones
+        std::list<EngineOutputs> Outputs;
+
+        std::unique_ptr<clang::FrontendAction> create() override {
+                Outputs.emplace_back();
+                return std::make_unique<EngineDiffAction>(Outputs.back());
+        }
+};
+
+static std::string fieldString(const llvm::json::Object &Record,
+                               llvm::StringRef Field) {
+        if (auto S = Record.getString(Field))
+                return S->str();
+        return "";
+}
+
+// The fields that identify a record, in the order records are sorted by.
+// Nested expansions of the same macro are spelled at the same location, so
+// their depth and number of arguments are part of the key too.
+static const char *const KeyFields[] = {
+        "PropertiesOf",       "Name",        "InvocationLocation",
+        "DefinitionLocation", "IncludeName", "InvocationDepth",
+        "NumArguments"
+};
+
+// A record emitted by an engine, with the keys it is sorted by
+struct Record {
+        std::string Key;
+        std::string Text;
+        llvm::json::Object Fields;
+
+        bool operator<(const Record &Other) const {
+                return std::tie(Key, Text) < std::tie(Other.Key, Other.Text);
+        }
+};
+
+// Parses the results of an engine and sorts them canonically: by their key
+// fields first, and by their full text to order records with the same key
+static bool parseRecords(llvm::StringRef Output, llvm::StringRef Engine,
+                         llvm::StringRef File, std::vector<Record> &Records) {
+        auto Val = llvm::json::parse(Output);
+        if (!Val) {
+                llvm::errs() << File << ": cannot parse " << Engine
+                             << " results: " << Val.takeError() << "\n";
+                return false;
+        }
+        auto Arr = Val->getAsArray();
+        if (!Arr) {
+                llvm::errs() << File << ": " << Engine
+                             << " results are not an array\n";
+                return false;
+        }
+
+        for (auto &&V : *Arr) {
+                auto O = V.getAsObject();
+                if (!O)
+                        continue;
+                Record R;
+                for (auto F : KeyFields) {
+                        if (auto KV = O->get(F))
+                                llvm::raw_string_ostream(R.Key) << *KV;
+                        R.Key += '\0';
+                }
+                llvm::raw_string_ostream(R.Text) << V;
+                R.Fields = *O;
+                Records.push_back(std::move(R));
+        }
+        std::sort(Records.begin(), Records.end());
+        return true;
+}
+
+// Returns where a record comes from, for printing differences
+static std::string describe(const Record &R) {
+        auto Loc = fieldString(R.Fields, "InvocationLocation");
+        if (Loc.empty())
+                Loc = fieldString(R.Fields, "DefinitionLocation");
+        if (Loc.empty())
+                Loc = fieldString(R.Fields, "IncludeName");
+        if (Loc.empty())
+                Loc = "<unknown location>";
+        auto Name = fieldString(R.Fields, "Name");
+        return Loc + ": " + fieldString(R.Fields, "PropertiesOf") +
+               (Name.empty() ? "" : " " + Name);
+}
+
+static std::string valueString(const llvm::json::Value *V) {
+        if (!V)
+                return "<missing>";
+        std::string S;
+        llvm::raw_string_ostream(S) << *V;
+        return S;
+}
+
+// Compares the records both engines emitted for a translation unit.
+// Returns the number of differences found.
+static unsigned compareOutputs(const EngineOutputs &Outputs) {
+        std::vector<Record> MatcherRecords, FastRecords;
+        if (!parseRecords(Outputs.Matcher, "matcher engine", Outputs.File,
+                          MatcherRecords) ||
+            !parseRecords(Outputs.Fast, "fast engine", Outputs.File,
+                          FastRecords))
+                return 1;
+
+        unsigned NumDiffs = 0;
+        auto Report = [&NumDiffs](const std::string &Message) {
+                NumDiffs++;
+                if (MaxDiffs == 0 || NumDiffs <= MaxDiffs)
+                        llvm::outs() << Message << "\n";
+        };
+
+        // Walk both sorted lists a group of records with the same key at a
+        // time. Records may still share a key, so the records of a group are
+        // matched up by their text, and only those left over are reported.
+        auto M = MatcherRecords.begin(), F = FastRecords.begin();
+        while (M != MatcherRecords.end() || F != FastRecords.end()) {
+                std::string Key = (F == FastRecords.end() ||
+                                   (M != MatcherRecords.end() &&
+                                    M->Key < F->Key)) ?
+                                          M->Key :
+                                          F->Key;
+                auto MEnd = M, FEnd = F;
+                while (MEnd != MatcherRecords.end() && MEnd->Key == Key)
+                        ++MEnd;
+                while (FEnd != FastRecords.end() && FEnd->Key == Key)
+                        ++FEnd;
+
+                // Records with the same key are sorted by their text
+                std::vector<const Record *> MatcherOnly, FastOnly;
+                while (M != MEnd || F != FEnd) {
+                        if (F == FEnd || (M != MEnd && M->Text < F->Text))
+                                MatcherOnly.push_back(&*M++);
+                        else if (M == MEnd || F->Text < M->Text)
+                                FastOnly.push_back(&*F++);
+                        else {
+                                ++M;
+                                ++F;
+                        }
+                }
+
+                // If each engine has one record left, they are the same
+                // record, so report the fields they differ in
+                if (MatcherOnly.size() == 1 && FastOnly.size() == 1) {
+                        auto &MR = *MatcherOnly.front();
+                        auto &FR = *FastOnly.front();
+                        std::set<std::string> Fields;
+                        for (auto &&KV : MR.Fields)
+                                Fields.insert(llvm::StringRef(KV.first).str());
+                        for (auto &&KV : FR.Fields)
+                                Fields.insert(llvm::StringRef(KV.first).str());
+                        for (auto &&Field : Fields) {
+                                auto MV = MR.Fields.get(Field);
+                                auto FV = FR.Fields.get(Field);
+                                if (MV && FV && *MV == *FV)
+                                        continue;
+                                Report(describe(MR) + ": " + Field +
+                                       ": matcher=" + valueString(MV) +
+                                       " fast=" + valueString(FV));
+                        }
+                        continue;
+                }
+                for (auto &&R : MatcherOnly)
+                        Report(describe(*R) + ": only emitted by the matcher "
+                                              "engine");
+                for (auto &&R : FastOnly)
+                        Report(describe(*R) + ": only emitted by the fast "
+                                              "engine");
+        }
+
+        if (MaxDiffs != 0 && NumDiffs > MaxDiffs)
+                llvm::outs() << Outputs.File << ": "
+                             << NumDiffs - MaxDiffs
+                             << " more differences not shown\n";
+        llvm::outs() << Outputs.File << ": " << MatcherRecords.size()
+                     << " records, " << NumDiffs << " differences\n";
+        return NumDiffs;
+}
+} // namespace cpp2c
+
+int main(int argc, const char **argv) {
+        using namespace cpp2c;
+
+        auto OptionsParser = clang::tooling::CommonOptionsParser::create(
+                argc, argv, EngineDiffCategory, llvm::cl::OneOrMore,
+                "Compare the results of cpp2c's matcher and fast engines\n");
+        if (!OptionsParser) {
+                llvm::errs() << OptionsParser.takeError();
+                return 1;
+        }
+
+        clang::tooling::ClangTool Tool(OptionsParser->getCompilations(),
+                                       OptionsParser->getSourcePathList());
+        // The tool does not live next to Clang's resource directory, so point
+        // the driver to the one of the compiler it was configured with
+        Tool.appendArgumentsAdjuster(clang::tooling::getInsertArgumentAdjuster(
+                "-resource-dir=" CPP2C_CLANG_RESOURCE_DIR,
+                clang::tooling::ArgumentInsertPosition::BEGIN));
+
+        EngineDiffActionFactory Factory;
+        int Status = Tool.run(&Factory);
+        if (Status != 0)
+                llvm::errs() << "cpp2c-engine-diff: some files could not be "
+                                "compiled; comparing what was analyzed\n";
+
+        unsigned NumDiffs = 0, NumFiles = 0;
+        for (auto &&Outputs : Factory.Outputs) {
+                NumFiles++;
+                NumDiffs += compareOutputs(Outputs);
+        }
+        llvm::outs() << NumFiles << " translation units, " << NumDiffs
+                     << " differences\n";
+        return (NumDiffs != 0 || Status != 0) ? 1 : 0;
+}
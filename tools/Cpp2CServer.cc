@@ -0,0 +1,197 @@
+// A fork server for running cpp2c on many compile commands.
+//
+// The server loads the Clang frontend and the cpp2c plugin once, then reads
+// compile commands from stdin, one JSON object per line, in the same format as
+// the entries of a compile_commands.json file:
+//
+//     { "directory": "/path/to/dir", "arguments": ["clang-14", ...] }
+//
+// It runs each compile command in a child process forked from the server, so
+// children share the already loaded frontend and plugin copy-on-write, and a
+// crash while analyzing one translation unit does not stop the server.
+// Whenever a child finishes, the server prints a line of the form
+//
+//     { "index": <i>, "status": <s> }
+//
+// to stdout, where <i> is the 0-based index of the compile command, and
+// <s> is the child's exit status, or the negated number of the signal that
+// killed it.
+// Children print their diagnostics to stderr. Anything they would print to
+// stdout is printed to stderr as well, so results should be written to files
+// with the plugin's output argument.
+
+#include "clang/Basic/DiagnosticOptions.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/CompilerInvocation.h"
+#include "clang/Frontend/Utils.h"
+#include "clang/FrontendTool/Utils.h"
+
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace cpp2c {
+static llvm::cl::opt<unsigned>
+        Jobs("j", llvm::cl::desc("Number of compile commands to run at once"),
+             llvm::cl::init(1));
+
+static llvm::cl::list<std::string>
+        Plugins("load", llvm::cl::desc("Plugin to load before forking"),
+                llvm::cl::value_desc("path"));
+
+// A compile command read from stdin
+struct CompileCommand {
+        std::string Directory;
+        std::vector<std::string> Arguments;
+};
+
+static bool parseCompileCommand(llvm::StringRef Line, CompileCommand &CC) {
+        auto Val = llvm::json::parse(Line);
+        if (!Val) {
+                llvm::errs() << "cpp2c-server: " << Val.takeError() << "\n";
+                return false;
+        }
+        llvm::json::Path::Root Root;
+        llvm::json::ObjectMapper O(*Val, Root);
+        if (!O || !O.map("directory", CC.Directory) ||
+            !O.map("arguments", CC.Arguments) || CC.Arguments.empty()) {
+                llvm::errs() << "cpp2c-server: invalid compile command: "
+                             << Line << "\n";
+                return false;
+        }
+        return true;
+}
+
+// Runs the given compile command in the current process and returns the exit
+// status
+static int runCompileCommand(const CompileCommand &CC) {
+        if (::chdir(CC.Directory.c_str()) != 0) {
+                llvm::errs() << "cpp2c-server: cannot change to directory '"
+                             << CC.Directory << "'\n";
+                return 1;
+        }
+
+        // The driver locates Clang's resource directory relative to the
+        // compiler executable, so it needs the executable's real path
+        std::string Compiler = CC.Arguments[0];
+        if (auto Found = llvm::sys::findProgramByName(Compiler))
+                Compiler = *Found;
+        llvm::SmallString<128> RealCompiler;
+        if (!llvm::sys::fs::real_path(Compiler, RealCompiler))
+                Compiler = RealCompiler.str().str();
+
+        std::vector<const char *> Args = { Compiler.c_str() };
+        for (auto It = CC.Arguments.begin() + 1; It != CC.Arguments.end();
+             ++It)
+                Args.push_back(It->c_str());
+
+        auto Diags = clang::CompilerInstance::createDiagnostics(
+                new clang::DiagnosticOptions());
+        std::shared_ptr<clang::CompilerInvocation> Invocation =
+                clang::createInvocationFromCommandLine(Args, Diags);
+        if (!Invocation)
+                return 1;
+
+        clang::CompilerInstance CI;
+        CI.setInvocation(Invocation);
+        CI.createDiagnostics();
+        if (!CI.hasDiagnostics())
+                return 1;
+        return clang::ExecuteCompilerInvocation(&CI) ? 0 : 1;
+}
+
+// Waits for a child to finish, prints its status, and forgets about it
+static void reapChild(std::map<pid_t, unsigned> &Children) {
+        int WStatus;
+        pid_t PID = ::waitpid(-1, &WStatus, 0);
+        if (PID < 0)
+                return;
+
+        int Status = WIFEXITED(WStatus)   ? WEXITSTATUS(WStatus) :
+                     WIFSIGNALED(WStatus) ? -WTERMSIG(WStatus) :
+                                            1;
+        auto It = Children.find(PID);
+        if (It == Children.end())
+                return;
+        llvm::outs() << llvm::json::Object{ { "index", It->second },
+                                            { "status", Status } }
+                     << "\n";
+        llvm::outs().flush();
+        Children.erase(It);
+}
+} // namespace cpp2c
+
+int main(int argc, char const *argv[]) {
+        using namespace cpp2c;
+
+        llvm::cl::ParseCommandLineOptions(argc, argv,
+                                          "cpp2c compile command server\n");
+        if (Jobs == 0)
+                Jobs = 1;
+
+        // Load plugins once here so that children inherit them
+        for (auto &&P : Plugins) {
+                std::string Err;
+                if (llvm::sys::DynamicLibrary::LoadLibraryPermanently(
+                            P.c_str(), &Err)) {
+                        llvm::errs() << "cpp2c-server: cannot load plugin '"
+                                     << P << "': " << Err << "\n";
+                        return 1;
+                }
+        }
+
+        std::map<pid_t, unsigned> Children;
+        std::string Line;
+        unsigned NextIndex = 0;
+        while (std::getline(std::cin, Line)) {
+                if (Line.empty())
+                        continue;
+                unsigned Index = NextIndex++;
+
+                CompileCommand CC;
+                if (!parseCompileCommand(Line, CC)) {
+                        llvm::outs() << llvm::json::Object{ { "index", Index },
+                                                            { "status", 1 } }
+                                     << "\n";
+                        llvm::outs().flush();
+                        continue;
+                }
+
+                while (Children.size() >= Jobs)
+                        reapChild(Children);
+
+                // Flush before forking so the child does not print our output
+                // a second time
+                llvm::outs().flush();
+                llvm::errs().flush();
+                pid_t PID = ::fork();
+                if (PID < 0) {
+                        llvm::errs() << "cpp2c-server: cannot fork\n";
+                        return 1;
+                }
+                if (PID == 0) {
+                        // Keep stdout free for the server's own output
+                        ::dup2(STDERR_FILENO, STDOUT_FILENO);
+                        int Status = runCompileCommand(CC);
+                        llvm::outs().flush();
+                        llvm::errs().flush();
+                        ::_exit(Status);
+                }
+                Children[PID] = Index;
+        }
+
+        while (!Children.empty())
+                reapChild(Children);
+        return 0;
+}